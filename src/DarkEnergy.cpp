@@ -71,12 +71,14 @@ struct DarkEnergy : Module {
 	int panelTheme;
 	
 	// Need to save, with reset
-	std::vector<FMOp> oscM;// size N_POLY
-	std::vector<FMOp> oscC;// size N_POLY
+	FMOpBank oscM;// N_POLY voices
+	FMOpBank oscC;// N_POLY voices
 	int plancks[2];// index is left/right, value is: 0 = not quantized, 1 = 5th+octs, 2 = adds -10V offset (LFO)
 	int mode;// main center modulation modes (bit 0 is fmDepth mode, bit 1 is feedback mode; a 0 bit means both sides CV modulated the same, a 1 bit means pos attenuverter mods right side only, neg atten means mod left side only (but still a positive attenuverter value though!))
 	int dest;// mult destination (bit 0 is fmDepth mode, bit 1 is feedback mode; a 0 bit means both sides CV modulated the same, a 1 bit means pos attenuverter mods right side only, neg atten means mod left side only (but still a positive attenuverter value though!))
 	int multEnable;
+	FMOpSettings settings;// context menu settings of the operators
+	int subSampleReset;// 0 = reset inputs restart the phases on the sample of the edge, 1 = from its interpolated crossing time
 	
 	// No need to save, with reset
 	int numChan;
@@ -84,17 +86,23 @@ struct DarkEnergy : Module {
 	float depths[2][N_POLY];// fm depth
 	float modSignals[2][N_POLY];
 	float lastVocts[N_POLY];
+	ControlRamp<6> controls;// modSignals, feedbacks and depths
 	
 	// No need to save, no reset
 	RefreshCounter refresh;
+	OversampleGovernor governor;
 	float resetLight0 = 0.0f;
 	float resetLight1 = 0.0f;
 	Trigger planckTriggers[2];
 	Trigger resetTriggers[3];// M inut, C input, button (trigs both)
+	float lastResetVoltages[2] = {};// M input, C input
 	Trigger modeTrigger;
+	ChangeDetector<18> controlChanges;// knobs, settings and connections, common to all channels
+	ChangeDetector<5> cvChanges[N_POLY];// CV voltages and multiply, per channel
 	Trigger multEnableTrigger;
 	Trigger multDestTrigger;
 	SlewLimiter multiplySignalSlewers[N_POLY];
+	float multiplySignalSlewed[N_POLY] = {};
 	SlewLimiter multiplyOnSlewer;
 	dsp::PulseGenerator multiplyPulses[N_POLY];// for cv delta to trig
 	
@@ -144,16 +152,17 @@ struct DarkEnergy : Module {
 		configOutput(M_OUTPUT, "M");
 		configOutput(C_OUTPUT, "C");
 		
-		oscM.reserve(N_POLY);
-		oscC.reserve(N_POLY);
 		for (int c = 0; c < N_POLY; c++) {
-			oscM.push_back(FMOp(APP->engine->getSampleRate()));
-			oscC.push_back(FMOp(APP->engine->getSampleRate()));
 			feedbacks[0][c] = 0.0f;
 			feedbacks[1][c] = 0.0f;
 			depths[0][c] = 0.0f;
 			depths[1][c] = 0.0f;
 		}
+		for (int i = 0; i < 2; i++) {
+			controls.values[i] = modSignals[i];
+			controls.values[2 + i] = feedbacks[i];
+			controls.values[4 + i] = depths[i];
+		}
 		onSampleRateChange();
 		onReset();
 
@@ -162,16 +171,17 @@ struct DarkEnergy : Module {
 	
 	
 	void onReset() override final {
-		for (int c = 0; c < N_POLY; c++) {
-			oscM[c].onReset();
-			oscC[c].onReset();
-		}
+		oscM.onReset();
+		oscC.onReset();
+		governor.reset();
 		for (int i = 0; i < 2; i++) {
 			plancks[i] = 0;
 		}
 		mode = 0x0;
 		dest = 0x0;
 		multEnable = 0x0;
+		settings.onReset();
+		subSampleReset = 0;
 		resetNonJson();
 	}
 	void resetNonJson() {
@@ -180,7 +190,10 @@ struct DarkEnergy : Module {
 			calcModSignals(c);
 			calcFeedbacks(c);
 			lastVocts[c] = inputs[FREQCV_INPUT].getVoltage(c);
+			cvChanges[c].reset();
 		}	
+		controlChanges.reset();// so that a loaded patch is recomputed at the first control update
+		controls.reset();
 	}	
 
 	
@@ -189,9 +202,10 @@ struct DarkEnergy : Module {
 
 	void onSampleRateChange() override final {
 		float sampleRate = APP->engine->getSampleRate();
+		oscM.onSampleRateChange(sampleRate);
+		oscC.onSampleRateChange(sampleRate);
+		governor.onSampleRateChange(sampleRate);
 		for (int c = 0; c < N_POLY; c++) {
-			oscM[c].onSampleRateChange(sampleRate);
-			oscC[c].onSampleRateChange(sampleRate);
 			multiplySignalSlewers[c].setParams2(sampleRate, MULTSLEW_RISETIME, getDecayTime(c), 1.0f);
 			multiplyOnSlewer.setParams(sampleRate, MULTSLEW_RISETIME, 1.0f);
 		}
@@ -205,11 +219,11 @@ struct DarkEnergy : Module {
 		json_object_set_new(rootJ, "panelTheme", json_integer(panelTheme));
 
 		// oscM and oscC
-		oscM[0].dataToJson(rootJ, "oscM_");// legacy so do outside loop
-		oscC[0].dataToJson(rootJ, "oscC_");// legacy so do outside loop
+		oscM.dataToJson(rootJ, "oscM_", 0);// legacy so do outside loop
+		oscC.dataToJson(rootJ, "oscC_", 0);// legacy so do outside loop
 		for (int c = 1; c < N_POLY; c++) {
-			oscM[c].dataToJson(rootJ, string::f("osc%iM_",c));
-			oscC[c].dataToJson(rootJ, string::f("osc%iC_",c));
+			oscM.dataToJson(rootJ, string::f("osc%iM_",c), c);
+			oscC.dataToJson(rootJ, string::f("osc%iC_",c), c);
 		}
 
 		// plancks
@@ -225,6 +239,12 @@ struct DarkEnergy : Module {
 		// multEnable
 		json_object_set_new(rootJ, "multEnable", json_integer(multEnable));
 
+		// operator settings
+		settings.dataToJson(rootJ);
+
+		// subSampleReset
+		json_object_set_new(rootJ, "subSampleReset", json_integer(subSampleReset));
+
 		return rootJ;
 	}
 
@@ -236,11 +256,11 @@ struct DarkEnergy : Module {
 			panelTheme = json_integer_value(panelThemeJ);
 
 		// oscM and oscC
-		oscM[0].dataFromJson(rootJ, "oscM_");// legacy so do outside loop
-		oscC[0].dataFromJson(rootJ, "oscC_");// legacy so do outside loop
+		oscM.dataFromJson(rootJ, "oscM_", 0);// legacy so do outside loop
+		oscC.dataFromJson(rootJ, "oscC_", 0);// legacy so do outside loop
 		for (int c = 1; c < N_POLY; c++) {
-			oscM[c].dataFromJson(rootJ, string::f("osc%iM_",c));
-			oscC[c].dataFromJson(rootJ, string::f("osc%iC_",c));
+			oscM.dataFromJson(rootJ, string::f("osc%iM_",c), c);
+			oscC.dataFromJson(rootJ, string::f("osc%iC_",c), c);
 		}
 
 		// plancks
@@ -266,10 +286,20 @@ struct DarkEnergy : Module {
 		if (multEnableJ)
 			multEnable = json_integer_value(multEnableJ);
 		
+		// operator settings
+		settings.dataFromJson(rootJ);
+
+		// subSampleReset
+		json_t *subSampleResetJ = json_object_get(rootJ, "subSampleReset");
+		if (subSampleResetJ)
+			subSampleReset = json_integer_value(subSampleResetJ) != 0 ? 1 : 0;
+		
 		resetNonJson();
 	}
 
 	void process(const ProcessArgs &args) override {	
+		governor.begin(settings.cpuBudget);
+		
 		// user inputs
 		if (refresh.processInputs()) {
 			numChan = std::max(1, inputs[FREQCV_INPUT].getChannels());
@@ -302,34 +332,59 @@ struct DarkEnergy : Module {
 			if (multEnableTrigger.process(params[MULTEN_PARAM].getValue())) {
 				multEnable ^= 0x1;
 			}
+			
+			// operator settings (set in context menu), auto quality limit
+			settings.apply(oscM);
+			settings.apply(oscC);
+			oscM.setOversampleLimit(governor.limit());
+			oscC.setOversampleLimit(governor.limit());
+			
+			// control rate, as a number of samples between modulation updates
+			controls.interval = settings.controlInterval(args.sampleRate);
 		
 			// refresh multslewers fall time (aka mult decay)
 			for (int c = 0; c < numChan; c++) {
 				multiplySignalSlewers[c].setParams2(args.sampleRate, MULTSLEW_RISETIME, getDecayTime(c), 1.0f);
 			}				
 			
-			// reset
-			if (resetTriggers[0].process(inputs[RESET_INPUTS + 0].getVoltage())) {
-				for (int c = 0; c < N_POLY; c++) {
-					oscM[c].onReset();
-					resetLight0 = 1.0f;
-				}
+			// reset button (the reset inputs are processed every sample below)
+			if (resetTriggers[2].process(params[RESET_PARAM].getValue())) {
+				oscM.onReset();
+				resetLight0 = 1.0f;
+				oscC.onReset();
+				resetLight1 = 1.0f;
 			}
-			if (resetTriggers[1].process(inputs[RESET_INPUTS + 1].getVoltage())) {
-				for (int c = 0; c < N_POLY; c++) {
-					oscC[c].onReset();
-					resetLight1 = 1.0f;
+		}// userInputs refresh
+		
+		
+		// reset inputs, edge detected every sample for hard sync; the time since the edge, in samples, 
+		//   is interpolated from the threshold crossing when sub-sample, and -1 when no reset
+		float sinceResets[2];
+		for (int i = 0; i < 2; i++) {
+			float resetVoltage = inputs[RESET_INPUTS + i].getVoltage();
+			sinceResets[i] = -1.0f;
+			if (resetTriggers[i].process(resetVoltage)) {
+				sinceResets[i] = 1.0f;
+				if (subSampleReset != 0) {
+					sinceResets[i] = clamp((resetVoltage - 0.9f) / (resetVoltage - lastResetVoltages[i]), 0.0f, 1.0f);// see Trigger
 				}
 			}
-			if (resetTriggers[2].process(params[RESET_PARAM].getValue())) {
-				for (int c = 0; c < N_POLY; c++) {
-					oscM[c].onReset();
-					resetLight0 = 1.0f;
-					oscC[c].onReset();
-					resetLight1 = 1.0f;
-				}
+			lastResetVoltages[i] = resetVoltage;
+		}
+		// the groups above the channel count restart as with onReset() (their pitch is unused), so that all 
+		//   the voices are in sync if the channel count grows; the active groups reset at their pitch below
+		if (sinceResets[0] >= 0.0f) {
+			resetLight0 = 1.0f;
+			for (int g = (numChan + 3) >> 2; g < FMOpBank::numGroups; g++) {
+				oscM.resetPhase(g, 0.0f, 1.0f);
 			}
-		}// userInputs refresh
+		}
+		if (sinceResets[1] >= 0.0f) {
+			resetLight1 = 1.0f;
+			for (int g = (numChan + 3) >> 2; g < FMOpBank::numGroups; g++) {
+				oscC.resetPhase(g, 0.0f, 1.0f);
+			}
+		}
 		
 		
 		// main signal flow
@@ -351,38 +406,79 @@ struct DarkEnergy : Module {
 			else {
 				slewInput = multiplyPulses[c].process(args.sampleTime) ? 1.0f : 0.0f;
 			}
-			float multiplySignalSlewed = multiplySignalSlewers[c].next(slewInput);
-			
-			
-			// pitch modulation, feedbacks and depths (some use multiplySignalSlewers[c]._last)
-			if ((refresh.refreshCounter & 0x3) == (c & 0x3)) {
-				// stagger0 updates channels 0, 4, 8,  12
-				// stagger1 updates channels 1, 5, 9,  13
-				// stagger2 updates channels 2, 6, 10, 14
-				// stagger3 updates channels 3, 7, 11, 15
-				calcModSignals(c);// voct modulation, a given channel is updated at sample_rate / 4
-				calcFeedbacks(c);// feedback (momentum), a given channel is updated at sample_rate / 4
-				calcDepths(c);// fmDepth (anti-gravity), a given channel is updated at sample_rate / 4
+			multiplySignalSlewed[c] = multiplySignalSlewers[c].next(slewInput);
+		}
+		
+		// pitch modulation, feedbacks and depths (some use multiplySignalSlewers[c]._last), 
+		//   at the control rate and recomputed only when something they depend on has moved
+		if (controls.tick(numChan)) {
+			for (int i = 0; i < 2; i++) {
+				controlChanges.add(params[FREQ_PARAMS + i].getValue());
+				controlChanges.add(params[MOMENTUM_PARAMS + i].getValue());
+				controlChanges.add(params[DEPTH_PARAMS + i].getValue());
+				controlChanges.add((float)plancks[i]);
+				controlChanges.add((float)inputs[FREQCV_INPUTS + i].getChannels());
 			}
+			controlChanges.add(params[FREQ_PARAM].getValue());
+			controlChanges.add(params[MOMENTUMCV_PARAM].getValue());
+			controlChanges.add(params[DEPTHCV_PARAM].getValue());
+			controlChanges.add((float)mode);
+			controlChanges.add((float)dest);
+			controlChanges.add((float)inputs[MOMENTUM_INPUT].getChannels());
+			controlChanges.add((float)inputs[ANTIGRAV_INPUT].getChannels());
+			controlChanges.add((float)numChan);// channels that were not processed may have missed a change
+			bool controlsChanged = controlChanges.changed();
+			for (int c = 0; c < numChan; c++) {
+				for (int i = 0; i < 2; i++) {
+					cvChanges[c].add(getCv(inputs[FREQCV_INPUTS + i], c));
+				}
+				cvChanges[c].add(getCv(inputs[MOMENTUM_INPUT], c));
+				cvChanges[c].add(getCv(inputs[ANTIGRAV_INPUT], c));
+				cvChanges[c].add(dest != 0 ? multiplySignalSlewers[c]._last : 0.0f);
+				bool cvsChanged = cvChanges[c].changed();
+				if (controlsChanged || cvsChanged) {
+					calcControls(c);
+				}
+				else {
+					controls.clear(c);
+				}
+			}
+			controls.update(numChan);
+		}
+		
+		for (int c = 0; c < numChan; c += 4) {
+			int g = c >> 2;
 			
 			// vocts
-			float base = inputs[FREQCV_INPUT].getVoltage(c);
-			const float vocts[2] = {base + modSignals[0][c], base + modSignals[1][c]};
+			simd::float_4 base = inputs[FREQCV_INPUT].getVoltageSimd<simd::float_4>(c);
+			simd::float_4 vocts[2] = {base + simd::float_4::load(&modSignals[0][c]), base + simd::float_4::load(&modSignals[1][c])};
 			
 			// oscillators
-			float oscMout = oscM[c].step(vocts[0], feedbacks[0][c] * 0.3f, depths[0][c], oscC[c]._feedbackDelayedSample);
-			float oscCout = oscC[c].step(vocts[1], feedbacks[1][c] * 0.3f, depths[1][c], oscM[c]._feedbackDelayedSample);
+			if (sinceResets[0] >= 0.0f) {
+				oscM.resetPhase(g, vocts[0], sinceResets[0]);
+			}
+			if (sinceResets[1] >= 0.0f) {
+				oscC.resetPhase(g, vocts[1], sinceResets[1]);
+			}
+			simd::float_4 oscMout;
+			simd::float_4 oscCout;
+			FMOpBank::stepPair(oscM, oscC, g, 
+				vocts[0], simd::float_4::load(&feedbacks[0][c]) * 0.3f, simd::float_4::load(&depths[0][c]), 
+				vocts[1], simd::float_4::load(&feedbacks[1][c]) * 0.3f, simd::float_4::load(&depths[1][c]), 
+				oscMout, oscCout);// M modulated by C's previous sample, C by M's new one
 						
 			// final signals
-			float attv1 = oscCout * oscCout * 0.2f * crossfade(1.0f, multiplySignalSlewed, multiplyOnSlewed);// C^2 is done here, with multiply
-			float attv2 = attv1 * oscMout * 0.2f;// ring mod is here
+			simd::float_4 attv1 = oscCout * oscCout * 0.2f * (1.0f + (simd::float_4::load(&multiplySignalSlewed[c]) - 1.0f) * multiplyOnSlewed);// C^2 is done here, with multiply
+			simd::float_4 attv2 = attv1 * oscMout * 0.2f;// ring mod is here
 			
 			// outputs
-			outputs[ENERGY_OUTPUT].setVoltage(-attv2, c);// inverted as per spec from Pyer
-			outputs[M_OUTPUT].setVoltage(oscMout, c);
-			outputs[C_OUTPUT].setVoltage(attv1, c);
+			outputs[ENERGY_OUTPUT].setVoltageSimd(-attv2, c);// inverted as per spec from Pyer
+			outputs[M_OUTPUT].setVoltageSimd(oscMout, c);
+			outputs[C_OUTPUT].setVoltageSimd(attv1, c);
 		}
 
+		governor.end(settings.cpuBudget, settings.oversample);
+
 		// lights
 		if (refresh.processLights()) {
 			float deltaTime = args.sampleTime * (RefreshCounter::displayRefreshStepSkips >> 2);
@@ -436,6 +532,14 @@ struct DarkEnergy : Module {
 		return (float)(retcv)/2.0f - 3.0f;
 	}
 	
+	void calcControls(int chan) {// voct modulation, feedback (momentum) and fmDepth (anti-gravity), ramped to over the control interval
+		controls.begin(chan);
+		calcModSignals(chan);
+		calcFeedbacks(chan);
+		calcDepths(chan);
+		controls.end(chan);
+	}
+	
 	void calcModSignals(int chan) {
 		for (int osci = 0; osci < 2; osci++) {
 			float freqValue = calcFreqKnob(osci) + params[FREQ_PARAM].getValue();
@@ -541,6 +645,13 @@ struct DarkEnergyWidget : ModuleWidget {
 		assert(module);
 
 		createPanelThemeMenu(menu, &(module->panelTheme));
+		
+		createFMOpSettingsMenu(menu, &(module->settings));
+		
+		menu->addChild(createCheckMenuItem("Sub-sample reset", "",
+			[=]() {return module->subSampleReset != 0;},
+			[=]() {module->subSampleReset ^= 0x1;}
+		));
 	}	
 	
 	DarkEnergyWidget(DarkEnergy *module) {
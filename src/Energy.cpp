@@ -54,8 +54,8 @@ struct Energy : Module {
 	int panelTheme;
 	
 	// Need to save, with reset
-	std::vector<FMOp> oscM;// size N_POLY
-	std::vector<FMOp> oscC;// size N_POLY
+	FMOpBank oscM;// N_POLY voices
+	FMOpBank oscC;// N_POLY voices
 	int routing;// routing of knob 1. 
 		// 0 is independant (i.e. blue only) (bottom light, light index 0),
 		// 1 is control (i.e. blue and yellow) (top light, light index 1),
@@ -63,19 +63,25 @@ struct Energy : Module {
 	int plancks[2];// index is left/right, value is: 0 = not quantized, 1 = semitones, 2 = 5th+octs, 3 = adds -10V offset
 	int modtypes[2];// index is left/right, value is: {0 to 3} = {bypass, add, amp}
 	int cross;// cross momentum active or not
+	FMOpSettings settings;// context menu settings of the operators
 	
 	// No need to save, with reset
 	int numChan;
 	float feedbacks[2][N_POLY];
 	float modSignals[2][N_POLY];
+	ControlRamp<4> controls;// modSignals and feedbacks
 	
 	// No need to save, no reset
 	RefreshCounter refresh;
+	OversampleGovernor governor;
 	Trigger routingTrigger;
 	Trigger planckTriggers[2];
 	Trigger modtypeTriggers[2];
 	Trigger crossTrigger;
 	SlewLimiter multiplySlewers[N_POLY];
+	float multiplySlewValues[N_POLY] = {};
+	ChangeDetector<16> controlChanges;// knobs, settings and connections, common to all channels
+	ChangeDetector<4> cvChanges[N_POLY];// CV voltages, per channel
 	
 	
 	Energy() {
@@ -101,14 +107,14 @@ struct Energy : Module {
 		
 		configOutput(ENERGY_OUTPUT, "Energy");
 		
-		oscM.reserve(N_POLY);
-		oscC.reserve(N_POLY);
 		for (int c = 0; c < N_POLY; c++) {
-			oscM.push_back(FMOp(APP->engine->getSampleRate()));
-			oscC.push_back(FMOp(APP->engine->getSampleRate()));
 			feedbacks[0][c] = 0.0f;
 			feedbacks[1][c] = 0.0f;
 		}
+		for (int i = 0; i < 2; i++) {
+			controls.values[i] = modSignals[i];
+			controls.values[2 + i] = feedbacks[i];
+		}
 		onSampleRateChange();
 		onReset();
 
@@ -117,16 +123,16 @@ struct Energy : Module {
 	
 	
 	void onReset() override final {
-		for (int c = 0; c < N_POLY; c++) {
-			oscM[c].onReset();
-			oscC[c].onReset();
-		}
+		oscM.onReset();
+		oscC.onReset();
+		governor.reset();
 		routing = 1;// default is control (i.e. blue and yellow) (top light, light index 1),
 		for (int i = 0; i < 2; i++) {
 			plancks[i] = 0;
 			modtypes[i] = 1;// default is add mode
 		}
 		cross = 0;
+		settings.onReset();
 		resetNonJson();
 	}
 	void resetNonJson() {
@@ -134,7 +140,10 @@ struct Energy : Module {
 		for (int c = 0; c < N_POLY; c++) {
 			calcModSignals(c);
 			calcFeedbacks(c);
+			cvChanges[c].reset();
 		}			
+		controlChanges.reset();// so that a loaded patch is recomputed at the first control update
+		controls.reset();
 	}	
 
 	
@@ -144,9 +153,10 @@ struct Energy : Module {
 
 	void onSampleRateChange() override final {
 		float sampleRate = APP->engine->getSampleRate();
+		oscM.onSampleRateChange(sampleRate);
+		oscC.onSampleRateChange(sampleRate);
+		governor.onSampleRateChange(sampleRate);
 		for (int c = 0; c < N_POLY; c++) {
-			oscM[c].onSampleRateChange(sampleRate);
-			oscC[c].onSampleRateChange(sampleRate);
 			multiplySlewers[c].setParams2(sampleRate, 2.5f, 20.0f, 1.0f);
 		}
 	}
@@ -159,11 +169,11 @@ struct Energy : Module {
 		json_object_set_new(rootJ, "panelTheme", json_integer(panelTheme));
 
 		// oscM and oscC
-		oscM[0].dataToJson(rootJ, "oscM_");// legacy so do outside loop
-		oscC[0].dataToJson(rootJ, "oscC_");// legacy so do outside loop
+		oscM.dataToJson(rootJ, "oscM_", 0);// legacy so do outside loop
+		oscC.dataToJson(rootJ, "oscC_", 0);// legacy so do outside loop
 		for (int c = 1; c < N_POLY; c++) {
-			oscM[c].dataToJson(rootJ, string::f("osc%iM_",c));
-			oscC[c].dataToJson(rootJ, string::f("osc%iC_",c));
+			oscM.dataToJson(rootJ, string::f("osc%iM_",c), c);
+			oscC.dataToJson(rootJ, string::f("osc%iC_",c), c);
 		}
 
 		// routing
@@ -179,6 +189,9 @@ struct Energy : Module {
 		
 		// cross
 		json_object_set_new(rootJ, "cross", json_integer(cross));
+		
+		// operator settings
+		settings.dataToJson(rootJ);
 
 		return rootJ;
 	}
@@ -191,11 +204,11 @@ struct Energy : Module {
 			panelTheme = json_integer_value(panelThemeJ);
 
 		// oscM and oscC
-		oscM[0].dataFromJson(rootJ, "oscM_");// legacy so do outside loop
-		oscC[0].dataFromJson(rootJ, "oscC_");// legacy so do outside loop
+		oscM.dataFromJson(rootJ, "oscM_", 0);// legacy so do outside loop
+		oscC.dataFromJson(rootJ, "oscC_", 0);// legacy so do outside loop
 		for (int c = 1; c < N_POLY; c++) {
-			oscM[c].dataFromJson(rootJ, string::f("osc%iM_",c));
-			oscC[c].dataFromJson(rootJ, string::f("osc%iC_",c));
+			oscM.dataFromJson(rootJ, string::f("osc%iM_",c), c);
+			oscC.dataFromJson(rootJ, string::f("osc%iC_",c), c);
 		}
 
 		// routing
@@ -224,10 +237,15 @@ struct Energy : Module {
 		if (crossJ)
 			cross = json_integer_value(crossJ);
 		
+		// operator settings
+		settings.dataFromJson(rootJ);
+		
 		resetNonJson();
 	}
 
 	void process(const ProcessArgs &args) override {	
+		governor.begin(settings.cpuBudget);
+		
 		// user inputs
 		if (refresh.processInputs()) {
 			numChan = std::max(1, inputs[FREQCV_INPUT].getChannels());
@@ -261,49 +279,98 @@ struct Energy : Module {
 				if (++cross > 1)
 					cross = 0;
 			}
+			
+			// operator settings (set in context menu), auto quality limit
+			settings.apply(oscM);
+			settings.apply(oscC);
+			oscM.setOversampleLimit(governor.limit());
+			oscC.setOversampleLimit(governor.limit());
+			
+			// control rate, as a number of samples between modulation updates
+			controls.interval = settings.controlInterval(args.sampleRate);
 		}// userInputs refresh
 		
 		
 		// main signal flow
 		// ----------------		
-		for (int c = 0; c < numChan; c++) {
-			// pitch modulation and feedbacks
-			if ((refresh.refreshCounter & 0x3) == (c & 0x3)) {
-				// stagger0 updates channels 0, 4, 8,  12
-				// stagger1 updates channels 1, 5, 9,  13
-				// stagger2 updates channels 2, 6, 10, 14
-				// stagger3 updates channels 3, 7, 11, 15
-				calcModSignals(c);// voct modulation, a given channel is updated at sample_rate / 4
-				calcFeedbacks(c);// feedback (momentum), a given channel is updated at sample_rate / 4
+		// pitch modulation and feedbacks, at the control rate and recomputed only when something they depend on has moved
+		// (feedbacks and mod signals of chan 0 are always calculated, since they are used in lights)
+		int numControlChan = outputs[ENERGY_OUTPUT].isConnected() ? numChan : 1;
+		if (controls.tick(numControlChan)) {
+			for (int i = 0; i < 2; i++) {
+				controlChanges.add(params[FREQ_PARAMS + i].getValue());
+				controlChanges.add(params[MOMENTUM_PARAMS + i].getValue());
+				controlChanges.add((float)plancks[i]);
+				controlChanges.add((float)modtypes[i]);
+				controlChanges.add((float)inputs[FREQCV_INPUTS + i].getChannels());
+				controlChanges.add((float)inputs[MOMENTUM_INPUTS + i].getChannels());
 			}
-			
-			if (!outputs[ENERGY_OUTPUT].isConnected()) {// this is placed here such that feedbacks and mod signals of chan 0 are always calculated, since they are used in lights
+			controlChanges.add((float)routing);
+			controlChanges.add((float)cross);
+			controlChanges.add((float)numChan);// channels that were not processed may have missed a change
+			controlChanges.add(outputs[ENERGY_OUTPUT].isConnected() ? 1.0f : 0.0f);// idem
+			bool controlsChanged = controlChanges.changed();
+			for (int c = 0; c < numControlChan; c++) {
+				for (int i = 0; i < 2; i++) {
+					cvChanges[c].add(getCv(inputs[FREQCV_INPUTS + i], c));
+					cvChanges[c].add(getCv(inputs[MOMENTUM_INPUTS + i], c));
+				}
+				bool cvsChanged = cvChanges[c].changed();
+				if (controlsChanged || cvsChanged) {
+					calcControls(c);
+				}
+				else {
+					controls.clear(c);
+				}
+			}
+			controls.update(numControlChan);
+		}
+		
+		for (int c = 0; c < numChan; c++) {
+			if (!outputs[ENERGY_OUTPUT].isConnected()) {
 				break;
 			}
 			
-			// vocts
-			const float vocts[2] = {modSignals[0][c] + inputs[FREQCV_INPUT].getVoltage(c), modSignals[1][c] + inputs[FREQCV_INPUT].getVoltage(c)};
-			
-			// oscillators
-			float oscMout = oscM[c].step(vocts[0], feedbacks[0][c] * 0.3f);
-			float oscCout = oscC[c].step(vocts[1], feedbacks[1][c] * 0.3f);
-			
 			// multiply 
 			float slewInput = 1.0f;
 			if (inputs[MULTIPLY_INPUT].isConnected()) {
 				int chan = std::min(inputs[MULTIPLY_INPUT].getChannels() - 1, c);
 				slewInput = (clamp(inputs[MULTIPLY_INPUT].getVoltage(chan) / 10.0f, 0.0f, 1.0f));
 			}
-			float multiplySlewValue = multiplySlewers[c].next(slewInput) * 0.2f;
-			
-			// final attenuverters
-			float attv1 = oscCout * oscCout * multiplySlewValue;
-			float attv2 = attv1 * oscMout * 0.2f;
-			
-			// output
-			outputs[ENERGY_OUTPUT].setVoltage(attv2, c);
+			multiplySlewValues[c] = multiplySlewers[c].next(slewInput) * 0.2f;
+		}
+		
+		if (outputs[ENERGY_OUTPUT].isConnected()) {
+			for (int c = 0; c < numChan; c += 4) {
+				// vocts
+				simd::float_4 base = inputs[FREQCV_INPUT].getVoltageSimd<simd::float_4>(c);
+				simd::float_4 vocts[2] = {simd::float_4::load(&modSignals[0][c]) + base, simd::float_4::load(&modSignals[1][c]) + base};
+				
+				// sleep: when multiply has settled at 0 in all the group's channels the output is 0, so only the phases advance
+				simd::float_4 multiply = simd::float_4::load(&multiplySlewValues[c]);
+				simd::float_4 used = (simd::float_4(0.0f, 1.0f, 2.0f, 3.0f) + (float)c) < (float)numChan;
+				if (simd::movemask(used & (multiply != 0.0f)) == 0) {
+					oscM.sleep(c >> 2, vocts[0]);
+					oscC.sleep(c >> 2, vocts[1]);
+					outputs[ENERGY_OUTPUT].setVoltageSimd(simd::float_4::zero(), c);
+					continue;
+				}
+				
+				// oscillators
+				simd::float_4 oscMout = oscM.step(c >> 2, vocts[0], simd::float_4::load(&feedbacks[0][c]) * 0.3f);
+				simd::float_4 oscCout = oscC.step(c >> 2, vocts[1], simd::float_4::load(&feedbacks[1][c]) * 0.3f);
+				
+				// final attenuverters
+				simd::float_4 attv1 = oscCout * oscCout * multiply;
+				simd::float_4 attv2 = attv1 * oscMout * 0.2f;
+				
+				// output
+				outputs[ENERGY_OUTPUT].setVoltageSimd(attv2, c);
+			}
 		}
 
+		governor.end(settings.cpuBudget, settings.oversample);
+
 		// lights
 		if (refresh.processLights()) {
 			// routing
@@ -350,6 +417,13 @@ struct Energy : Module {
 		return (float)(retcv)/2.0f - 3.0f;
 	}
 	
+	void calcControls(int chan) {// voct modulation and feedback (momentum), ramped to over the control interval
+		controls.begin(chan);
+		calcModSignals(chan);
+		calcFeedbacks(chan);
+		controls.end(chan);
+	}
+	
 	inline void calcModSignals(int chan) {
 		for (int osci = 0; osci < 2; osci++) {
 			float freqValue = calcFreqKnob(osci);
@@ -415,6 +489,8 @@ struct EnergyWidget : ModuleWidget {
 		assert(module);
 
 		createPanelThemeMenu(menu, &(module->panelTheme));
+		
+		createFMOpSettingsMenu(menu, &(module->settings));
 	}	
 	
 	EnergyWidget(Energy *module) {
@@ -1,8 +1,8 @@
 //***********************************************************************************************
 //Relativistic Oscillator kernel
 //
-//Based on the BogAudio FM-OP oscillator by Matt Demanett
-//  99.9% of the code here is by Matt Demanett
+//Derived from the BogAudio FM-OP oscillator by Matt Demanett,
+//  rewritten as FMOpBank, a SIMD bank of operators
 //See ./LICENSE.txt for all licenses
 //
 //***********************************************************************************************
@@ -40,253 +40,825 @@ float SlewLimiter::next(float sample, float last) {
 
 
 //-----------------------------------------------------------------------------
-// Amplifier
+// Decimator
 //-----------------------------------------------------------------------------
 
-void Table::generate() {
-	if (!_table) {
-		_table = new float[_length] {};
-		_generate();
+static const float halfBandEco8to4[2] = {2.712638327e-01f, -2.126383267e-02f};// 7 taps, Kaiser beta 3
+static const float halfBandEco4to2[3] = {3.032746574e-01f, -6.632547190e-02f, 1.305081454e-02f};// 11 taps, Kaiser beta 3
+static const float halfBandEco2to1[6] = {3.170357309e-01f, -9.740075610e-02f, 4.932418777e-02f, -2.680280768e-02f, 1.380839921e-02f, -5.964754152e-03f};// 23 taps, Kaiser beta 3
+static const float halfBandHq8to4[4] = {2.978023393e-01f, -5.693043646e-02f, 9.397768383e-03f, -2.696711921e-04f};// 15 taps, Kaiser beta 7
+static const float halfBandHq4to2[6] = {3.098113170e-01f, -8.301142843e-02f, 3.146643247e-02f, -1.051624609e-02f, 2.421522771e-03f, -1.715977333e-04f};// 23 taps, Kaiser beta 7
+static const float halfBandHq2to1[16] = {3.172464180e-01f, -1.029285869e-01f, 5.848872226e-02f, -3.847447195e-02f, 2.677057646e-02f, -1.900655210e-02f, 1.350955410e-02f, -9.494843120e-03f, 
+	6.534554549e-03f, -4.363677364e-03f, 2.798948005e-03f, -1.702140689e-03f, 9.628413694e-04f, -4.903487273e-04f, 2.099117173e-04f, -6.090562917e-05f};// 63 taps, Kaiser beta 7
+
+void HalfBandDecimator4::setProfile(int profile) {
+	if (profile == HQ_PROFILE) {
+		_stage16to8.setCoefs(4, halfBandHq8to4);
+		_stage8to4.setCoefs(4, halfBandHq8to4);
+		_stage4to2.setCoefs(6, halfBandHq4to2);
+		_stage2to1.setCoefs(16, halfBandHq2to1);
+	}
+	else {
+		_stage16to8.setCoefs(2, halfBandEco8to4);
+		_stage8to4.setCoefs(2, halfBandEco8to4);
+		_stage4to2.setCoefs(3, halfBandEco4to2);
+		_stage2to1.setCoefs(6, halfBandEco2to1);
 	}
 }
 
-void SineTable::_generate() {
-	const float twoPI = 2.0f * float(M_PI);
-	for (int i = 0, j = _length / 4; i <= j; ++i) {
-		_table[i] = std::sin(twoPI * (i / (float)_length));
+simd::float_4 HalfBandDecimator4::next(const simd::float_4* buf, int factor) {
+	simd::float_4 buf8[8];
+	if (factor >= 16) {
+		for (int i = 0; i < 8; i++) {
+			buf8[i] = _stage16to8.next(buf[2 * i], buf[2 * i + 1]);
+		}
+		buf = buf8;
 	}
-	for (int i = 1, j = _length / 4; i < j; ++i) {
-		_table[i + j] = _table[j - i];
+	simd::float_4 buf4[4];
+	if (factor >= 8) {
+		for (int i = 0; i < 4; i++) {
+			buf4[i] = _stage8to4.next(buf[2 * i], buf[2 * i + 1]);
+		}
+		buf = buf4;
 	}
-	for (int i = 0, j = _length / 2; i < j; ++i) {
-		_table[i + j] = -_table[i];
+	simd::float_4 buf2[2];
+	if (factor >= 4) {
+		for (int i = 0; i < 2; i++) {
+			buf2[i] = _stage4to2.next(buf[2 * i], buf[2 * i + 1]);
+		}
+		buf = buf2;
+	}
+	if (factor >= 2) {
+		return _stage2to1.next(buf[0], buf[1]);
 	}
+	return buf[0];
 }
 
 
 //-----------------------------------------------------------------------------
-// Decimator
+// FMOpBank
 //-----------------------------------------------------------------------------
 
-CICDecimator::CICDecimator(int stages, int factor) {
-	assert(stages > 0);
-	_stages = stages;
-	_integrators = new T[_stages + 1] {};
-	_combs = new T[_stages] {};
-	setParams(0.0f, factor);
+static const float referenceFrequency = 261.626; // C4; frequency at which Rack 1v/octave CVs are zero.
+
+void FMOpBank::onReset() {
+	for (int g = 0; g < numGroups; g++) {
+		_phase[g] = 0;
+		_resetAdaa(_adaaBase[g], _phase[g]);
+		_adaaLoopPrimed[g] = false;
+	}
+}
+
+void FMOpBank::resetPhase(int g, simd::float_4 voct, float sinceReset) {
+	// the next step() advances by one sample, so the phase starts from sinceReset - 1 samples of the voice's increment
+	simd::float_4 frequency = dsp::exp2_taylor5(voct) * referenceFrequency;// as in _step()
+	frequency = simd::fmin(frequency, simd::float_4(_maxFrequency));
+	_phase[g] = simd::int32_4(frequency * (_deltaPerHz * (sinceReset - 1.0f)));
+	_resetAdaa(_adaaBase[g], _phase[g]);
+	_adaaLoopPrimed[g] = false;
 }
 
-CICDecimator::~CICDecimator() {
-	delete[] _integrators;
-	delete[] _combs;
+void FMOpBank::dataToJson(json_t *rootJ, std::string id, int voice) {
+	json_object_set_new(rootJ, (id + "phase").c_str(), json_integer((phase_t)_phase[voice >> 2][voice & 0x3]));
 }
 
-CICDecimator::CICDecimator(const CICDecimator& srcc) {
-	copyFrom(srcc);
+void FMOpBank::dataFromJson(json_t *rootJ, std::string id, int voice) {
+	json_t *phaseJ = json_object_get(rootJ, (id + "phase").c_str());
+	if (phaseJ)
+		_phase[voice >> 2][voice & 0x3] = (int32_t)((phase_t)json_integer_value(phaseJ));
+	_resetAdaa(_adaaBase[voice >> 2], _phase[voice >> 2]);
 }
-void CICDecimator::copyFrom(const CICDecimator& srcc) {
-	// just dummy for now, finish implementing if needed
-	_stages = srcc._stages;
-	if (_integrators != nullptr) {
-		delete[] _integrators;
+
+void FMOpBank::onSampleRateChange(const float newSampleRate) {
+	_sampleRate = newSampleRate;
+	_maxFrequency = 0.475f * newSampleRate;
+	_deltaPerHz = (float)maxPhase / newSampleRate;
+	_downshiftHoldSteps = (int)(0.1f * newSampleRate) / adaptInterval;
+	_feedbackSlewDelta = 1.0f / ((5.0f / 1000.0f) * newSampleRate);// as in SlewLimiter::setParams()
+}
+
+void FMOpBank::setDecimator(int decimator) {
+	// applied by _adaptOversample(), through a transition at the group's factor
+	_decimator = decimator;
+}
+
+void FMOpBank::setOversample(int oversample) {
+	// applied by _adaptOversample(), so that the groups shift to it as when adapting
+	_oversample = clamp(oversample, 1, maxOversample);
+}
+void FMOpBank::setEngine(int engine) {
+	if (_engine == engine) {
+		return;
 	}
-	_integrators = new T[_stages + 1] {};// should copy 
-	if (_combs != nullptr) {
-		delete[] _combs;
+	// the ADAA history restarts from the current phases; the factor cap is applied by _adaptOversample()
+	_engine = engine;
+	for (int g = 0; g < numGroups; g++) {
+		_resetAdaa(_adaaBase[g], _phase[g]);
+		_adaaLoopPrimed[g] = false;
 	}
-	_combs = new T[_stages] {};// should copy 
-	setParams(0.0f, srcc._factor);	
+}
+void FMOpBank::_restartOversampling(int g) {
+	_groupOversample[g] = 1;// adapts back up from here
+	_nextOversample[g] = 0;
+	_groupOversampling[g] = false;
+	_downshiftHold[g] = 0;
+	_adaaLoopPrimed[g] = false;
 }
 
-CICDecimator& CICDecimator::operator=(const CICDecimator& srcc) {
-	copyFrom(srcc);
-	return *this;
+void FMOpBank::GroupDecimator::reset(int decimator) {
+	std::memset(cicIntegrators, 0, sizeof(cicIntegrators));
+	std::memset(cicCombs, 0, sizeof(cicCombs));
+	halfBand.setProfile(decimator == HALFBAND_HQ_DECIMATOR ? HalfBandDecimator4::HQ_PROFILE : HalfBandDecimator4::ECO_PROFILE);
+	type = decimator;
 }
 
-void CICDecimator::setParams(float _sampleRate, int factor) {
-	assert(factor > 0);
-	if (_factor != factor) {
-		_factor = factor;
-		_gainCorrection = 1.0f / (float)(pow(_factor, _stages));
+simd::float_4 FMOpBank::_feedbackHarmonics(simd::float_4 feedbackIndex) {
+	// Harmonics less than 60 dB down: feedback of index b < 1 gives harmonics decaying as r^n, with 
+	//   r = b * exp(s) / (1 + s) and s = sqrt(1 - b^2) (Kapteyn series); from b = 1 on it is a sawtooth, 
+	//   whose harmonics never die out
+	simd::float_4 b = simd::clamp(feedbackIndex, simd::float_4(1e-6f), simd::float_4(0.999f));
+	simd::float_4 sq = simd::sqrt(1.0f - b * b);
+	simd::float_4 logR = simd::log(b) + sq - simd::log(1.0f + sq);
+	simd::float_4 harmonics = simd::ifelse(feedbackIndex > 0.0f, simd::float_4(-6.9078f) / logR, simd::float_4(1.0f));// ln(1000) = 6.9078
+	return simd::ifelse(feedbackIndex >= 1.0f, simd::float_4(INFINITY), harmonics);
+}
+
+simd::float_4 FMOpBank::_bandwidth(int g, simd::float_4 voct) const {
+	// highest significant partial of group g's output at pitch voct, from its own feedback, for when it modulates 
+	//   another bank (its own FM is left out, as it would be circular in a cross-modulated pair)
+	simd::float_4 frequency = dsp::exp2_taylor5(voct) * referenceFrequency;// as in _step()
+	frequency = simd::fmin(frequency, simd::float_4(_maxFrequency));
+	simd::float_4 feedback = _feedbackSlewed[g];
+	return frequency * _feedbackHarmonics((feedback > 0.001f) & (feedback * amplitude));
+}
+
+float FMOpBank::_highestPartial(simd::float_4 frequency, simd::float_4 feedbackIndex, simd::float_4 fmIndex, simd::float_4 fmBandwidth, simd::float_4 modulating) {
+	// Highest partial that is less than 60 dB down, over the voices of a group: the feedback harmonics,
+	//   widened by FM following Carson's rule, (index + 1) times the modulator's bandwidth around each partial
+	simd::float_4 highest = frequency * _feedbackHarmonics(feedbackIndex);
+	highest += (fmIndex > 0.0f) & ((fmIndex + 1.0f) * fmBandwidth);
+	highest = modulating & highest;
+	return std::fmax(std::fmax(highest[0], highest[1]), std::fmax(highest[2], highest[3]));
+}
+
+bool FMOpBank::_adaptOversample(int g, float highestPartial, simd::float_4 oversampleMix) {
+	int factor = _groupOversample[g];
+	if (_nextOversample[g] != 0) {
+		return true;// a transition runs to its end before the next shift
+	}
+	// smallest factor whose aliases of the highest partial fold back above the audible band, or the maximum when not adaptive
+	int maxFactor = std::min(_oversample, _oversampleLimit);
+	if (_engine != OVERSAMPLING_ENGINE) {
+		maxFactor = std::min(maxFactor, (int)adaaMaxOversample);
+	}
+	int needed = _adaptive ? 1 : maxFactor;
+	while (needed < maxFactor && (float)needed * _sampleRate < highestPartial + audibleBandwidth) {
+		needed <<= 1;
+	}
+	bool shift = false;
+	if (needed >= factor) {
+		_downshiftHold[g] = 0;
+		shift = needed > factor;
+	}
+	else if (factor > maxFactor) {
+		shift = true;// above a lowered maximum, no hold
+	}
+	else {
+		shift = ++_downshiftHold[g] >= _downshiftHoldSteps;
+	}
+	if (!shift) {
+		if (factor == 1 || _decimators[g][_currentDecimator[g]].type == _decimator) {
+			return factor > 1;
+		}
+		needed = factor;// the decimator changed
+	}
+	if (needed > 1 && factor > 1) {
+		// between two oversampled factors: crossfade into the second decimator, with no drop to 1x
+		_downshiftHold[g] = 0;
+		_beginTransition(g, needed);
+		return true;
+	}
+	if (simd::movemask(oversampleMix > 0.0f) == 0) {
+		_groupOversample[g] = needed;
+		_downshiftHold[g] = 0;
+		_decimators[g][_currentDecimator[g]].reset(_decimator);
+		return needed > 1;
 	}
+	return false;// fade the group out of oversampling first (at 1x, the mix only goes down)
+}
+
+void FMOpBank::_beginTransition(int g, int factor) {
+	_nextOversample[g] = factor;
+	_transitionSteps[g] = 0;
+	_decimators[g][_currentDecimator[g] ^ 1].reset(_decimator);
+}
+
+void FMOpBank::_endTransition(int g) {
+	_groupOversample[g] = _nextOversample[g];
+	_nextOversample[g] = 0;
+	_currentDecimator[g] ^= 1;
+}
+
+simd::int32_4 FMOpBank::turnsToPhase(simd::float_4 turns) {
+	// two lanes at a time, then the low halves of the four doubles are gathered
+	const __m128d magic = _mm_set1_pd(1572864.0);// 1.5 * 2^20
+	__m128d lo = _mm_add_pd(_mm_cvtps_pd(turns.v), magic);
+	__m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(turns.v, turns.v)), magic);
+	return _mm_castps_si128(_mm_shuffle_ps(_mm_castpd_ps(lo), _mm_castpd_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
 }
 
-float CICDecimator::next(const float* buf) {
-	for (int i = 0; i < _factor; ++i) {
-		_integrators[0] = buf[i] * scale;
-		for (int j = 1; j <= _stages; ++j) {
-			_integrators[j] += _integrators[j - 1];
+simd::float_4 FMOpBank::_decimate(GroupDecimator& d, int factor, int stride, const simd::float_4* buf, simd::float_4 active, simd::float_4& feedback) {
+	simd::float_4 strided[maxOversample];
+	if (stride > 1) {
+		for (int i = 0; i < factor; i++) {
+			strided[i] = buf[(i + 1) * stride - 1];
 		}
+		buf = strided;
 	}
-	T s = _integrators[_stages];
-	for (int i = 0; i < _stages; ++i) {
-		T t = s;
-		s -= _combs[i];
-		_combs[i] = t;
+	if (d.type != CIC_DECIMATOR) {
+		// the half-band cascade is too late for the feedback loops (see HalfBandDecimator4), so these 
+		//   take the last sub-sample instead, which is where the non-oversampled sine is taken
+		feedback = active & buf[factor - 1];
+		return d.halfBand.next(buf, factor);
 	}
-	return _gainCorrection * (s / (float)scale);
+	
+	// CIC on the four voices of a group, two int64 lanes per register; the float to int64
+	//   conversion truncates, and both conversions go through doubles (exact for |x| < 2^51)
+	const __m128d magic = _mm_set1_pd(6755399441055744.0);// 1.5 * 2^52
+	const __m128i magicBits = _mm_castpd_si128(magic);
+	__m128i active32 = _mm_castps_si128(_mm_cmpneq_ps(active.v, _mm_setzero_ps()));
+	__m128 ret[2];
+	for (int h = 0; h < 2; h++) {
+		int v = h << 1;
+		__m128i keep = _mm_cvtepi32_epi64(h == 0 ? active32 : _mm_srli_si128(active32, 8));// voices not oversampling keep their state
+		__m128i integrators[cicStages + 1];
+		for (int j = 0; j <= cicStages; ++j) {
+			integrators[j] = _mm_load_si128((const __m128i*)&d.cicIntegrators[j][v]);
+		}
+		for (int i = 0; i < factor; ++i) {
+			__m128 x = (buf[i] * (float)cicScale).v;
+			__m128d d = _mm_round_pd(_mm_cvtps_pd(h == 0 ? x : _mm_movehl_ps(x, x)), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+			integrators[0] = _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(d, magic)), magicBits);
+			for (int j = 1; j <= cicStages; ++j) {
+				integrators[j] = _mm_add_epi64(integrators[j], integrators[j - 1]);
+			}
+		}
+		for (int j = 0; j <= cicStages; ++j) {
+			__m128i* dst = (__m128i*)&d.cicIntegrators[j][v];
+			_mm_store_si128(dst, _mm_blendv_epi8(_mm_load_si128(dst), integrators[j], keep));
+		}
+		__m128i s = integrators[cicStages];
+		for (int i = 0; i < cicStages; ++i) {
+			__m128i* comb = (__m128i*)&d.cicCombs[i][v];
+			__m128i c = _mm_load_si128(comb);
+			_mm_store_si128(comb, _mm_blendv_epi8(c, s, keep));
+			s = _mm_sub_epi64(s, c);
+		}
+		ret[h] = _mm_cvtpd_ps(_mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(s, magicBits)), magic));
+	}
+	simd::float_4 s = _mm_movelh_ps(ret[0], ret[1]);
+	float gainCorrection = 1.0f;// 1 / factor^stages, exact since the factor is a power of 2
+	for (int i = 0; i < cicStages; ++i) {
+		gainCorrection /= (float)factor;
+	}
+	feedback = active & (gainCorrection * (s / (float)cicScale));
+	return feedback;
 }
 
+simd::float_4 FMOpBank::_decimateGroup(int g, int loopFactor, const simd::float_4* buf, simd::float_4 active, simd::float_4& feedback) {
+	int factor = _groupOversample[g];// above 1, since the mix only rises at these
+	simd::float_4 y = _decimate(_decimators[g][_currentDecimator[g]], factor, loopFactor / factor, buf, active, feedback);
+	int next = _nextOversample[g];
+	if (next == 0) {
+		return y;
+	}
+	// the loop runs at the higher of the two factors, and the next decimator is primed before it is faded in
+	simd::float_4 nextFeedback;
+	simd::float_4 nextY = _decimate(_decimators[g][_currentDecimator[g] ^ 1], next, loopFactor / next, buf, active, nextFeedback);
+	float fade = (float)(++_transitionSteps[g] - transitionPrimeSteps) / (float)transitionFadeSteps;
+	if (fade <= 0.0f) {
+		return y;
+	}
+	if (fade >= 1.0f) {
+		_endTransition(g);
+		feedback = nextFeedback;
+		return nextY;
+	}
+	feedback += fade * (nextFeedback - feedback);
+	return y + fade * (nextY - y);
+}
 
-//-----------------------------------------------------------------------------
-// SineTableOscillator
-//-----------------------------------------------------------------------------
+template<int KERNEL, int ENGINE, int INTERPOLATION>
+inline simd::float_4 FMOpBank::_step(int g, simd::int32_4& phase, simd::float_4& feedbackSlewed, simd::float_4& feedbackDelayedSample, simd::float_4& oversampleMix, 
+		simd::float_4 voct, simd::float_4 momentum, simd::float_4 fmDepth, simd::float_4 fmInput, const FMOpBank* modulator, simd::float_4 modulatorVoct) {
+	const bool hasFeedback = KERNEL == FEEDBACK_KERNEL || KERNEL == FEEDBACK_FM_KERNEL;
+	const bool hasFm = KERNEL == FM_KERNEL || KERNEL == FEEDBACK_FM_KERNEL;
+	
+	// the pitch is tracked every sample, so the exponential is the polynomial dsp::exp2_taylor5()
+	//   instead of std::pow(); its relative error of at most 6e-6 is about 0.01 cents
+	simd::float_4 frequency = dsp::exp2_taylor5(voct) * referenceFrequency;
+	frequency = simd::fmin(frequency, simd::float_4(_maxFrequency));
 
-void Phasor::setSampleWidth(float sw) {
-	if (sw < 0.0f) {
-		sw = 0.0f;
+	simd::float_4 feedback = simd::clamp(momentum, feedbackSlewed - _feedbackSlewDelta, feedbackSlewed + _feedbackSlewDelta);
+	feedbackSlewed = feedback;
+	
+	if (KERNEL == PLAIN_KERNEL) {
+		// no lane modulated nor oversampling: the oversampled steps are a single phase advance
+		// (the mix can have settled slightly below 0, so it is still applied as in the other kernels)
+		phase += simd::int32_4(frequency * _deltaPerHz);
+		return feedbackDelayedSample = amplitude * ((1.0f - oversampleMix) * _sine<ENGINE, INTERPOLATION>(phase, _adaaBase[g]));
 	}
-	else if (sw > maxSampleWidth) {
-		sw = maxSampleWidth;
+
+	simd::float_4 modulating = simd::float_4::zero();
+	simd::int32_4 o = 0;
+	simd::float_4 feedbackGain = 0.0f;// offsets in turns, see turnsToPhase()
+	simd::float_4 fmOffset = 0.0f;
+	if (hasFeedback || hasFm) {
+		simd::float_4 feedbackIndex = 0.0f;// peak phase deviations, in radians
+		simd::float_4 fmIndex = 0.0f;
+		if (hasFeedback) {
+			simd::float_4 feedbackOn = feedback > 0.001f;
+			feedbackGain = feedbackOn & (feedback * turnsPerRadian);
+			feedbackIndex = feedbackOn & (feedback * amplitude);
+			modulating = feedbackOn;
+		}
+		if (hasFm) {
+			fmOffset = fmInput * (fmDepth * (2.0f * turnsPerRadian));
+			fmIndex = simd::abs(fmDepth) * (2.0f * amplitude);
+			modulating = modulating | (fmDepth > 0.001f);
+		}
+		o = turnsToPhase(feedbackGain * feedbackDelayedSample + fmOffset);
+		
+		if (--_adaptCountdown[g] <= 0) {
+			_adaptCountdown[g] = adaptInterval;
+			// an unknown modulator may have any bandwidth, which takes the highest factor
+			simd::float_4 fmBandwidth = !hasFm ? simd::float_4::zero() : modulator ? modulator->_bandwidth(g, modulatorVoct) : simd::float_4(INFINITY);
+			_groupOversampling[g] = _adaptOversample(g, _highestPartial(frequency, feedbackIndex, fmIndex, fmBandwidth, modulating), oversampleMix);
+		}
+		if (!_groupOversampling[g]) {
+			modulating = simd::float_4::zero();
+		}
 	}
-	if (_sampleWidth != sw) {
-		_sampleWidth = sw;
-		if (_sampleWidth > 0.001f) {
-			_samplePhase = _sampleWidth * (float)maxPhase;
+	int factor = std::max(_groupOversample[g], _nextOversample[g]);// both decimators are fed during a transition
+	simd::int32_4 delta = simd::int32_4(frequency * (_deltaPerHz / (float)factor));
+	simd::float_4 mixUp = simd::ifelse(oversampleMix < 1.0f, simd::float_4(oversampleMixIncrement), simd::float_4::zero());
+	simd::float_4 mixDown = simd::ifelse(oversampleMix > 0.0f, simd::float_4(-oversampleMixIncrement), simd::float_4::zero());
+	oversampleMix += simd::ifelse(modulating, mixUp, mixDown);
+
+	simd::float_4 sample = 0.0f;
+	simd::float_4 feedbackSample = 0.0f;// what the feedback and the other operator's FM see
+	simd::float_4 oversampling = oversampleMix > 0.0f;
+	bool inLoop = false;
+	if (simd::movemask(oversampling) != 0) {
+		simd::float_4 buffer[maxOversample];
+		if (!_adaaLoopPrimed[g]) {
+			_resetAdaa(_adaaLoop[g], phase + o);
+			_adaaLoopPrimed[g] = true;
+		}
+		if (hasFeedback && _inLoopFeedback) {
+			// self-feedback from the smoothed previous sub-sample, see feedbackLoopCoefficient()
+			simd::float_4 loopGain = feedbackGain * amplitude;
+			simd::float_4 a = _feedbackLoopCoefficients[factor];
+			simd::float_4 y = _feedbackLoop[g];
+			for (int i = 0; i < factor; ++i) {
+				phase += delta;
+				buffer[i] = _sine<ENGINE, INTERPOLATION>(phase + turnsToPhase(fmOffset + loopGain * y), _adaaLoop[g]);
+				y += a * (buffer[i] - y);
+			}
+			_feedbackLoop[g] = y;
+			inLoop = true;
 		}
 		else {
-			_samplePhase = 0;
+			for (int i = 0; i < factor; ++i) {
+				phase += delta;
+				buffer[i] = _sine<ENGINE, INTERPOLATION>(phase + o, _adaaLoop[g]);
+			}
+		}
+		simd::float_4 feedbackDecimated;
+		sample = oversampleMix * _decimateGroup(g, factor, buffer, oversampling, feedbackDecimated);
+		feedbackSample = oversampleMix * feedbackDecimated;
+	}
+	else {
+		phase += simd::int32_4(_mm_mullo_epi32(delta.v, _mm_set1_epi32(factor)));
+		_adaaLoopPrimed[g] = false;
+		if (_nextOversample[g] != 0) {
+			_endTransition(g);// neither decimator is heard
 		}
 	}
+	simd::float_4 mixing = oversampleMix < 1.0f;
+	if (simd::movemask(mixing) != 0 || ENGINE != OVERSAMPLING_ENGINE) {// ADAA needs every sample of its history
+		simd::float_4 base = (mixing & (1.0f - oversampleMix)) * _sine<ENGINE, INTERPOLATION>(phase + o, _adaaBase[g]);
+		sample += base;
+		feedbackSample += base;
+	}
+	if (hasFeedback && !inLoop) {
+		_feedbackLoop[g] = feedbackSample;
+	}
+
+	feedbackDelayedSample = amplitude * feedbackSample;
+	return amplitude * sample;
 }
 
-void Phasor::resetPhase() {
-	_phase = 0;
+int FMOpBank::_selectKernel(int g, simd::float_4 maxMomentum, bool fm) {
+	// conservative: a kernel is only picked when the features it leaves out are off in every lane
+	bool feedback = simd::movemask((maxMomentum > 0.001f) | (_feedbackSlewed[g] > 0.001f)) != 0;// the slew stays below both
+	if (feedback) {
+		return fm ? FEEDBACK_FM_KERNEL : FEEDBACK_KERNEL;
+	}
+	if (fm) {
+		return FM_KERNEL;
+	}
+	return simd::movemask(_oversampleMix[g] > 0.0f) != 0 ? RAMP_KERNEL : PLAIN_KERNEL;
 }
 
-void Phasor::setPhase(float radians) {
-	_phase = radiansToPhase(radians);
+// Calls f.run<KERNEL, ENGINE, INTERPOLATION>() for the runtime ids, so that the settings are tested once per call
+//   rather than per sine (the second order ADAA always uses the polynomial sine, so it takes no interpolation)
+template<int KERNEL, int ENGINE, class F>
+static typename F::result dispatchInterpolation(F& f, int interpolation) {
+	switch (interpolation) {
+		case FMOpBank::LINEAR_INTERPOLATION:
+			return f.template run<KERNEL, ENGINE, FMOpBank::LINEAR_INTERPOLATION>();
+		case FMOpBank::CUBIC_INTERPOLATION:
+			return f.template run<KERNEL, ENGINE, FMOpBank::CUBIC_INTERPOLATION>();
+		case FMOpBank::POLYNOMIAL_INTERPOLATION:
+			return f.template run<KERNEL, ENGINE, FMOpBank::POLYNOMIAL_INTERPOLATION>();
+		default:
+			return f.template run<KERNEL, ENGINE, FMOpBank::NEAREST_INTERPOLATION>();
+	}
 }
 
-float Phasor::nextFromPhasor(const Phasor& phasor, phase_delta_t offset) {
-	offset += phasor._phase;
-	if (_samplePhase > 0) {
-		offset -= offset % _samplePhase;
+template<int KERNEL, class F>
+static typename F::result dispatchEngine(F& f, int engine, int interpolation) {
+	switch (engine) {
+		case FMOpBank::ADAA1_ENGINE:
+			return dispatchInterpolation<KERNEL, FMOpBank::ADAA1_ENGINE>(f, interpolation);
+		case FMOpBank::ADAA2_ENGINE:
+			return f.template run<KERNEL, FMOpBank::ADAA2_ENGINE, FMOpBank::POLYNOMIAL_INTERPOLATION>();
+		default:
+			return dispatchInterpolation<KERNEL, FMOpBank::OVERSAMPLING_ENGINE>(f, interpolation);
 	}
-	return _nextForPhase(offset);
 }
 
-void Phasor::_update() {
-	_delta = ((phase_delta_t)((_frequency / _sampleRate) * (float)maxPhase)) % maxPhase;
+template<class F>
+static typename F::result dispatchKernel(F& f, int kernel, int engine, int interpolation) {
+	switch (kernel) {
+		case FMOpBank::PLAIN_KERNEL:
+			return dispatchEngine<FMOpBank::PLAIN_KERNEL>(f, engine, interpolation);
+		case FMOpBank::RAMP_KERNEL:
+			return dispatchEngine<FMOpBank::RAMP_KERNEL>(f, engine, interpolation);
+		case FMOpBank::FEEDBACK_KERNEL:
+			return dispatchEngine<FMOpBank::FEEDBACK_KERNEL>(f, engine, interpolation);
+		case FMOpBank::FM_KERNEL:
+			return dispatchEngine<FMOpBank::FM_KERNEL>(f, engine, interpolation);
+		default:
+			return dispatchEngine<FMOpBank::FEEDBACK_FM_KERNEL>(f, engine, interpolation);
+	}
 }
 
-float Phasor::_next() {
-	advancePhase();
-	if (_samplePhase > 0) {
-		return _nextForPhase(_phase - (_phase % _samplePhase));
+struct StepCall {
+	typedef simd::float_4 result;
+	FMOpBank* bank;
+	int g;
+	simd::float_4 voct;
+	simd::float_4 momentum;
+	simd::float_4 fmDepth;
+	simd::float_4 fmInput;
+	const FMOpBank* modulator;
+	simd::float_4 modulatorVoct;
+	
+	template<int KERNEL, int ENGINE, int INTERPOLATION>
+	simd::float_4 run() {
+		return bank->_step<KERNEL, ENGINE, INTERPOLATION>(g, bank->_phase[g], bank->_feedbackSlewed[g], bank->_feedbackDelayedSample[g], bank->_oversampleMix[g], 
+			voct, momentum, fmDepth, fmInput, modulator, modulatorVoct);
 	}
-	return _nextForPhase(_phase);
+};
+
+simd::float_4 FMOpBank::_stepKernel(int kernel, int g, simd::float_4 voct, simd::float_4 momentum, simd::float_4 fmDepth, simd::float_4 fmInput, 
+		const FMOpBank* modulator, simd::float_4 modulatorVoct) {
+	StepCall call = {this, g, voct, momentum, fmDepth, fmInput, modulator, modulatorVoct};
+	return dispatchKernel(call, kernel, _engine, _interpolation);
 }
 
-float Phasor::_nextForPhase(phase_t phase) {
-	return phase;
+simd::float_4 FMOpBank::step(int g, simd::float_4 voct, simd::float_4 momentum, simd::float_4 fmDepth, simd::float_4 fmInput) {
+	return _stepKernel(_selectKernel(g, momentum, simd::movemask(fmDepth != 0.0f) != 0), g, voct, momentum, fmDepth, fmInput, nullptr, 0.0f);
 }
 
-float TablePhasor::_nextForPhase(phase_t phase) {
-	if (_tableLength >= 1024) {
-		int i = (((((uint64_t)phase) << 16) / maxPhase) * _tableLength) >> 16;
-		if (i >= _tableLength) {
-			i %= _tableLength;
-		}
-		return _table.value(i);
+template<int KERNEL, int ENGINE, int INTERPOLATION>
+void FMOpBank::_stepPair(FMOpBank& m, FMOpBank& c, int g, 
+		simd::float_4 voctM, simd::float_4 momentumM, simd::float_4 fmDepthM, 
+		simd::float_4 voctC, simd::float_4 momentumC, simd::float_4 fmDepthC, 
+		simd::float_4& outM, simd::float_4& outC) {
+	outM = m._step<KERNEL, ENGINE, INTERPOLATION>(g, m._phase[g], m._feedbackSlewed[g], m._feedbackDelayedSample[g], m._oversampleMix[g], voctM, momentumM, fmDepthM, c._feedbackDelayedSample[g], &c, voctC);
+	outC = c._step<KERNEL, ENGINE, INTERPOLATION>(g, c._phase[g], c._feedbackSlewed[g], c._feedbackDelayedSample[g], c._oversampleMix[g], voctC, momentumC, fmDepthC, m._feedbackDelayedSample[g], &m, voctM);
+}
+
+struct StepPairCall {
+	typedef void result;
+	FMOpBank* m;
+	FMOpBank* c;
+	int g;
+	simd::float_4 voctM;
+	simd::float_4 momentumM;
+	simd::float_4 fmDepthM;
+	simd::float_4 voctC;
+	simd::float_4 momentumC;
+	simd::float_4 fmDepthC;
+	simd::float_4* outM;
+	simd::float_4* outC;
+	
+	template<int KERNEL, int ENGINE, int INTERPOLATION>
+	void run() {
+		FMOpBank::_stepPair<KERNEL, ENGINE, INTERPOLATION>(*m, *c, g, voctM, momentumM, fmDepthM, voctC, momentumC, fmDepthC, *outM, *outC);
+	}
+};
+
+void FMOpBank::stepPair(FMOpBank& m, FMOpBank& c, int g, 
+		simd::float_4 voctM, simd::float_4 momentumM, simd::float_4 fmDepthM, 
+		simd::float_4 voctC, simd::float_4 momentumC, simd::float_4 fmDepthC, 
+		simd::float_4& outM, simd::float_4& outC) {
+	int kernelM = m._selectKernel(g, momentumM, simd::movemask(fmDepthM != 0.0f) != 0);
+	int kernelC = c._selectKernel(g, momentumC, simd::movemask(fmDepthC != 0.0f) != 0);
+	if (kernelM != kernelC || m._engine != c._engine || m._interpolation != c._interpolation) {
+		// a shared, more general kernel would round the phase and time the adaptation differently, so mixed pairs step apart
+		outM = m._stepKernel(kernelM, g, voctM, momentumM, fmDepthM, c._feedbackDelayedSample[g], &c, voctC);
+		outC = c._stepKernel(kernelC, g, voctC, momentumC, fmDepthC, m._feedbackDelayedSample[g], &m, voctM);
+		return;
 	}
+	StepPairCall call = {&m, &c, g, voctM, momentumM, fmDepthM, voctC, momentumC, fmDepthC, &outM, &outC};
+	dispatchKernel(call, kernelM, m._engine, m._interpolation);
+}
 
-	float fi = (phase / (float)maxPhase) * _tableLength;
-	int i = (int)fi;
-	if (i >= _tableLength) {
-		i %= _tableLength;
+void FMOpBank::sleep(int g, simd::float_4 voct) {
+	if (_groupOversample[g] != 1 || simd::movemask(_oversampleMix[g] > 0.0f) != 0) {
+		_oversampleMix[g] = 0.0f;
+		_restartOversampling(g);
 	}
-	float v1 = _table.value(i);
-	float v2 = _table.value(i + 1 == _tableLength ? 0 : i + 1);
-	return v1 + (fi - i)*(v2 - v1);
+	simd::float_4 frequency = dsp::exp2_taylor5(voct) * referenceFrequency;// as in _step()
+	frequency = simd::fmin(frequency, simd::float_4(_maxFrequency));
+	_phase[g] += simd::int32_4(frequency * _deltaPerHz);
+	_feedbackDelayedSample[g] = 0.0f;
+	_feedbackLoop[g] = 0.0f;
+	_resetAdaa(_adaaBase[g], _phase[g]);
+}
+
+template<int KERNEL, int ENGINE, int INTERPOLATION>
+void FMOpBank::_processBlock(int g, int n, const simd::float_4* voct, const simd::float_4* momentum, const simd::float_4* fmDepth, const simd::float_4* fmInput, simd::float_4* out) {
+	// the group's state stays in locals for the whole block
+	simd::int32_4 phase = _phase[g];
+	simd::float_4 feedbackSlewed = _feedbackSlewed[g];
+	simd::float_4 feedbackDelayedSample = _feedbackDelayedSample[g];
+	simd::float_4 oversampleMix = _oversampleMix[g];
+	
+	for (int i = 0; i < n; i++) {
+		simd::float_4 depth = fmDepth ? fmDepth[i] : 0.0f;
+		simd::float_4 input = fmInput ? fmInput[i] : 0.0f;
+		out[i] = _step<KERNEL, ENGINE, INTERPOLATION>(g, phase, feedbackSlewed, feedbackDelayedSample, oversampleMix, voct[i], momentum[i], depth, input, nullptr, 0.0f);
+	}
+	
+	_phase[g] = phase;
+	_feedbackSlewed[g] = feedbackSlewed;
+	_feedbackDelayedSample[g] = feedbackDelayedSample;
+	_oversampleMix[g] = oversampleMix;
+}
+
+struct ProcessBlockCall {
+	typedef void result;
+	FMOpBank* bank;
+	int g;
+	int n;
+	const simd::float_4* voct;
+	const simd::float_4* momentum;
+	const simd::float_4* fmDepth;
+	const simd::float_4* fmInput;
+	simd::float_4* out;
+	
+	template<int KERNEL, int ENGINE, int INTERPOLATION>
+	void run() {
+		bank->_processBlock<KERNEL, ENGINE, INTERPOLATION>(g, n, voct, momentum, fmDepth, fmInput, out);
+	}
+};
+
+void FMOpBank::processBlock(int g, int n, const simd::float_4* voct, const simd::float_4* momentum, const simd::float_4* fmDepth, const simd::float_4* fmInput, simd::float_4* out) {
+	// the kernel is picked once for the whole block
+	simd::float_4 maxMomentum = -INFINITY;
+	bool fm = false;
+	for (int i = 0; i < n; i++) {
+		maxMomentum = simd::fmax(maxMomentum, momentum[i]);
+		if (fmDepth && fmInput) {
+			fm |= simd::movemask(fmDepth[i] != 0.0f) != 0;
+		}
+	}
+	if (!fm) {
+		fmDepth = nullptr;
+		fmInput = nullptr;
+	}
+	ProcessBlockCall call = {this, g, n, voct, momentum, fmDepth, fmInput, out};
+	dispatchKernel(call, _selectKernel(g, maxMomentum, fm), _engine, _interpolation);
 }
 
 
 //-----------------------------------------------------------------------------
-// FMOp
+// OversampleGovernor
 //-----------------------------------------------------------------------------
 
-const float referenceFrequency = 261.626; // C4; frequency at which Rack 1v/octave CVs are zero.
-
-inline float cvToFrequency(float cv) {
-	return std::pow(2.0f, cv) * referenceFrequency;
+void OversampleGovernor::onSampleRateChange(float sampleRate) {
+	float measureRate = sampleRate / (float)measureInterval;
+	_loadCoefficient = 1.0f - std::exp(-1.0f / (averageTime * measureRate));
+	_nanosecondsToLoad = sampleRate * 1e-9f;
+	_holdMeasures = (int)(holdTime * measureRate);
 }
 
-void FMOp::onReset() {
-	_steps = modulationSteps;
-	_phasor.resetPhase();
+void OversampleGovernor::_update(float nanoseconds, int budget, int oversample) {
+	// the limit halves above the budget and doubles below upshiftHeadroom of it, then holds while the average settles
+	_load += _loadCoefficient * (nanoseconds * _nanosecondsToLoad - _load);
+	if (budget <= 0) {
+		return;// switched off during the measure
+	}
+	_limit = std::min(_limit, oversample);// so that a lowered setting does not leave headroom to climb back through
+	if (++_hold < _holdMeasures) {
+		return;
+	}
+	float target = (float)budget * 0.01f;
+	if (_load > target && _limit > 1) {
+		_limit >>= 1;
+		_hold = 0;
+	}
+	else if (_load < target * upshiftHeadroom && _limit < oversample) {
+		_limit <<= 1;
+		_hold = 0;
+	}
 }
 
-void FMOp::dataToJson(json_t *rootJ, std::string id) {
-	json_object_set_new(rootJ, (id + "phase").c_str(), json_integer(_phasor.getPhase()));
-}
 
-void FMOp::dataFromJson(json_t *rootJ, std::string id) {
-	json_t *phaseJ = json_object_get(rootJ, (id + "phase").c_str());
-	if (phaseJ)
-		_phasor.setPhase((Phasor::phase_t)json_integer_value(phaseJ));
-}
+//-----------------------------------------------------------------------------
+// FMOpSettings
+//-----------------------------------------------------------------------------
 
-void FMOp::onSampleRateChange(const float newSampleRate) {
-	_steps = modulationSteps;
-	_phasor.setSampleRate(newSampleRate);
-	_decimator.setParams(newSampleRate, oversample);
-	_maxFrequency = 0.475f * newSampleRate;
-	_feedbackSL.setParams(newSampleRate, 5.0f, 1.0f);
+void FMOpSettings::onReset() {
+	decimator = FMOpBank::CIC_DECIMATOR;
+	interpolation = FMOpBank::NEAREST_INTERPOLATION;
+	oversample = FMOpBank::defaultOversample;
+	engine = FMOpBank::OVERSAMPLING_ENGINE;
+	adaptive = 0;
+	inLoopFeedback = 0;
+	cpuBudget = 0;
+	controlRate = 0;
 }
 
-float FMOp::step(float voct, float momentum, float fmDepth, float fmInput) {
-	++_steps;
-	if (_steps >= modulationSteps) {
-		_steps = 0;
-		float frequency = voct;
-		//frequency += params[FINE_PARAM].value / 12.0f;
-		frequency = cvToFrequency(frequency);
-		// frequency *= ratio;
-		frequency = clamp(frequency, -_maxFrequency, _maxFrequency);
-		_phasor.setFrequency(frequency / (float)oversample);
-	}
+void FMOpSettings::dataToJson(json_t *rootJ) {
+	// decimator
+	json_object_set_new(rootJ, "decimator", json_integer(decimator));
 
-	float feedback = _feedbackSL.next(momentum);
-	bool feedbackOn = feedback > 0.001f;
+	// interpolation
+	json_object_set_new(rootJ, "interpolation", json_integer(interpolation));
 
-	float offset = 0.0f;
-	if (feedbackOn) {
-		offset = feedback * _feedbackDelayedSample;
-	}
+	// oversample
+	json_object_set_new(rootJ, "oversample", json_integer(oversample));
 
-	bool depthOn = false;
-	if (fmDepth != 0.0f) {
-		offset += fmInput * fmDepth * 2.0f;
-		depthOn = fmDepth > 0.001f;
-	}
+	// engine
+	json_object_set_new(rootJ, "engine", json_integer(engine));
 
+	// adaptive
+	json_object_set_new(rootJ, "adaptive", json_integer(adaptive));
+
+	// inLoopFeedback
+	json_object_set_new(rootJ, "inLoopFeedback", json_integer(inLoopFeedback));
+
+	// cpuBudget
+	json_object_set_new(rootJ, "cpuBudget", json_integer(cpuBudget));
+
+	// controlRate
+	json_object_set_new(rootJ, "controlRate", json_integer(controlRate));
+}
 
-	float sample = 0.0f;
+void FMOpSettings::dataFromJson(json_t *rootJ) {
+	// decimator
+	json_t *decimatorJ = json_object_get(rootJ, "decimator");
+	if (decimatorJ)
+		decimator = clamp((int)json_integer_value(decimatorJ), 0, FMOpBank::NUM_DECIMATORS - 1);
 	
-	Phasor::phase_delta_t o = Phasor::radiansToPhase(offset);
-	if (feedbackOn || depthOn) {
-		if (_oversampleMix < 1.0f) {
-			_oversampleMix += oversampleMixIncrement;
+	// interpolation
+	json_t *interpolationJ = json_object_get(rootJ, "interpolation");
+	if (interpolationJ)
+		interpolation = clamp((int)json_integer_value(interpolationJ), 0, FMOpBank::NUM_INTERPOLATIONS - 1);
+	
+	// oversample, a power of 2 since the adaptation doubles and halves it
+	json_t *oversampleJ = json_object_get(rootJ, "oversample");
+	if (oversampleJ) {
+		int requested = clamp((int)json_integer_value(oversampleJ), 1, (int)FMOpBank::maxOversample);
+		oversample = 1;
+		while (oversample * 2 <= requested) {
+			oversample <<= 1;
 		}
 	}
-	else if (_oversampleMix > 0.0f) {
-		_oversampleMix -= oversampleMixIncrement;
-	}
+	
+	// engine
+	json_t *engineJ = json_object_get(rootJ, "engine");
+	if (engineJ)
+		engine = clamp((int)json_integer_value(engineJ), 0, FMOpBank::NUM_ENGINES - 1);
+	
+	// adaptive, absent from the patches saved before it, which keep the maximum factor
+	json_t *adaptiveJ = json_object_get(rootJ, "adaptive");
+	if (adaptiveJ)
+		adaptive = json_integer_value(adaptiveJ) != 0 ? 1 : 0;
+	
+	// inLoopFeedback
+	json_t *inLoopFeedbackJ = json_object_get(rootJ, "inLoopFeedback");
+	if (inLoopFeedbackJ)
+		inLoopFeedback = json_integer_value(inLoopFeedbackJ) != 0 ? 1 : 0;
+
+	// cpuBudget
+	json_t *cpuBudgetJ = json_object_get(rootJ, "cpuBudget");
+	if (cpuBudgetJ)
+		cpuBudget = clamp((int)json_integer_value(cpuBudgetJ), 0, 100);
+
+	// controlRate
+	json_t *controlRateJ = json_object_get(rootJ, "controlRate");
+	if (controlRateJ)
+		controlRate = std::max((int)json_integer_value(controlRateJ), 0);
+}
 
-	if (_oversampleMix > 0.0f) {
-		for (int i = 0; i < oversample; ++i) {
-			_phasor.advancePhase();
-			_buffer[i] = _sineTable.nextFromPhasor(_phasor, o);
-		}
-		sample = _oversampleMix * _decimator.next(_buffer);
-	}
-	else {
-		_phasor.advancePhase(oversample);
-	}
-	if (_oversampleMix < 1.0f) {
-		sample += (1.0f - _oversampleMix) * _sineTable.nextFromPhasor(_phasor, o);
-	}
+void FMOpSettings::apply(FMOpBank& bank) {
+	bank.setDecimator(decimator);
+	bank.setOversample(oversample);
+	bank.setEngine(engine);
+	bank.setAdaptive(adaptive != 0);
+	bank.setInterpolation(interpolation);
+	bank.setInLoopFeedback(inLoopFeedback != 0);
+}
 
-	return _feedbackDelayedSample = amplitude * sample;
+void createFMOpSettingsMenu(ui::Menu* menu, FMOpSettings* settings) {
+	menu->addChild(new MenuSeparator());
+	menu->addChild(createMenuLabel("Settings"));
+	
+	menu->addChild(createSubmenuItem("Anti-aliasing", "", [=](Menu* menu) {
+		const std::string names[FMOpBank::NUM_ENGINES] = {"Oversampling", "ADAA 1st order (max 2x)", "ADAA 2nd order (max 2x)"};
+		for (int i = 0; i < FMOpBank::NUM_ENGINES; i++) {
+			menu->addChild(createCheckMenuItem(names[i], "",
+				[=]() {return settings->engine == i;},
+				[=]() {settings->engine = i;}
+			));
+		}
+	}));
+	
+	menu->addChild(createSubmenuItem("Max oversampling", "", [=](Menu* menu) {
+		for (int f = 1; f <= FMOpBank::maxOversample; f <<= 1) {
+			menu->addChild(createCheckMenuItem(string::f("%ix", f), "",
+				[=]() {return settings->oversample == f;},
+				[=]() {settings->oversample = f;}
+			));
+		}
+	}));
+	
+	menu->addChild(createCheckMenuItem("Adaptive oversampling", "",
+		[=]() {return settings->adaptive != 0;},
+		[=]() {settings->adaptive ^= 0x1;}
+	));
+	
+	menu->addChild(createSubmenuItem("Auto quality (CPU budget)", "", [=](Menu* menu) {
+		const int budgets[5] = {0, 5, 10, 20, 40};
+		for (int i = 0; i < 5; i++) {
+			int b = budgets[i];
+			menu->addChild(createCheckMenuItem(b == 0 ? "Off" : string::f("%i%%", b), "",
+				[=]() {return settings->cpuBudget == b;},
+				[=]() {settings->cpuBudget = b;}
+			));
+		}
+	}));
+	
+	menu->addChild(createSubmenuItem("Control rate", "", [=](Menu* menu) {
+		const int rates[5] = {0, 1000, 2000, 4000, 8000};
+		for (int i = 0; i < 5; i++) {
+			int r = rates[i];
+			menu->addChild(createCheckMenuItem(r == 0 ? "Audio rate" : string::f("%i kHz", r / 1000), "",
+				[=]() {return settings->controlRate == r;},
+				[=]() {settings->controlRate = r;}
+			));
+		}
+	}));
+	
+	menu->addChild(createSubmenuItem("Decimator", "", [=](Menu* menu) {
+		const std::string names[FMOpBank::NUM_DECIMATORS] = {"CIC", "Half-band eco", "Half-band HQ"};
+		for (int i = 0; i < FMOpBank::NUM_DECIMATORS; i++) {
+			menu->addChild(createCheckMenuItem(names[i], "",
+				[=]() {return settings->decimator == i;},
+				[=]() {settings->decimator = i;}
+			));
+		}
+	}));
+	
+	menu->addChild(createSubmenuItem("Sine lookup", "", [=](Menu* menu) {
+		const std::string names[FMOpBank::NUM_INTERPOLATIONS] = {"Nearest", "Linear", "Cubic", "Polynomial"};
+		for (int i = 0; i < FMOpBank::NUM_INTERPOLATIONS; i++) {
+			menu->addChild(createCheckMenuItem(names[i], "",
+				[=]() {return settings->interpolation == i;},
+				[=]() {settings->interpolation = i;}
+			));
+		}
+	}));
+	
+	menu->addChild(createCheckMenuItem("Momentum per oversampled sub-sample", "",
+		[=]() {return settings->inLoopFeedback != 0;},
+		[=]() {settings->inLoopFeedback ^= 0x1;}
+	));
 }
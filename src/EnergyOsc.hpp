@@ -1,8 +1,8 @@
 //***********************************************************************************************
 //Relativistic Oscillator kernel
 //
-//Based on the BogAudio FM-OP oscillator by Matt Demanett
-//  99.9% of the code here is by Matt Demanett
+//Derived from the BogAudio FM-OP oscillator by Matt Demanett,
+//  rewritten as FMOpBank, a SIMD bank of operators
 //See ./LICENSE.txt for all licenses
 //
 //***********************************************************************************************
@@ -11,6 +11,12 @@
 #pragma once
 
 #include "Geodesics.hpp"
+#include <chrono>
+#if defined ARCH_X64
+	#include <smmintrin.h>// SSE4.1, within Rack's x64 target
+#else
+	#include <simde/x86/sse4.1.h>// as Rack's simd headers on arm64
+#endif
 
 
 //-----------------------------------------------------------------------------
@@ -41,271 +47,585 @@ struct SlewLimiter {
 // StaticSineTable
 //-----------------------------------------------------------------------------
 
+// The static tables are generated by the compiler into read-only data, so that neither plugin loading
+//   nor the first module instance does any table work, and no thread can see a table half built.
+
+// Taylor series of sin(x), summed from the smallest term; double precision for |x| up to pi/2 and a little beyond,
+//   which covers every argument the tables below use
+constexpr double _sineSeries(double x2, double term, int n) {
+	return n > 11 ? 0.0 : term + _sineSeries(x2, -term * x2 / ((2 * n + 2) * (2 * n + 3)), n + 1);
+}
+constexpr double constexprSine(double x) {
+	return _sineSeries(x * x, x, 0);
+}
+
+// Index lists built by halves, to keep template recursion shallow for tables of thousands of entries (C++11 has no std::index_sequence)
+template<int... I> struct IndexList {};
+template<class A, class B> struct ConcatIndexLists;
+template<int... A, int... B> struct ConcatIndexLists<IndexList<A...>, IndexList<B...>> {
+	typedef IndexList<A..., (int(sizeof...(A)) + B)...> type;
+};
+template<int N> struct MakeIndexList {
+	typedef typename ConcatIndexLists<typename MakeIndexList<N / 2>::type, typename MakeIndexList<N - N / 2>::type>::type type;
+};
+template<> struct MakeIndexList<0> {
+	typedef IndexList<> type;
+};
+template<> struct MakeIndexList<1> {
+	typedef IndexList<0> type;
+};
+
+// Storage of a table with T::value(i, bits) for each stored entry i (guards included, from 0)
+template<class T, int N> struct StaticTableData {
+	static constexpr int size = T::guardsBefore + (1 << N) + T::guardsAfter;
+	struct Values {
+		float v[size];
+	};
+	template<int... I> static constexpr Values generate(IndexList<I...>) {
+		return Values{{T::value(I, N)...}};
+	}
+	static constexpr Values values = generate(typename MakeIndexList<size>::type());
+};
+template<class T, int N> constexpr typename StaticTableData<T, N>::Values StaticTableData<T, N>::values;
+
 class Table {
 protected:
-	int _length = 0;
-	float* _table = NULL;
+	int _length;
+	int _guardsBefore;// entries stored before the start and past the end, for interpolating lookups
+	int _guardsAfter;
+	const float* _table;
 
 public:
-	Table(int n = 10) {
-		assert(n > 0);
-		assert(n <= 16);
-		_length = 1 << n;
-	}
-	virtual ~Table() {
-		if (_table) {
-			delete[] _table;
-		}
+	constexpr Table(int bits, const float* values, int guardsBefore, int guardsAfter)
+	: _length(1 << bits)
+	, _guardsBefore(guardsBefore)
+	, _guardsAfter(guardsAfter)
+	, _table(values + guardsBefore)
+	{
 	}
 
-	inline int length() const { return _length; }
-
 	inline float value(int i) const {
-		assert(i >= 0 && i < _length);
-		assert(_table);
+		assert(i >= -_guardsBefore && i < _length + _guardsAfter);
 		return _table[i];
 	}
-
-	void generate();
-
-protected:
-	virtual void _generate() = 0;
+	
+	inline const float* data() const {
+		return _table;
+	}
 };
 
 
+// T describes the contents: guardsBefore, guardsAfter and a constexpr value(i, bits)
 template<class T, int N> class StaticTable {
 private:
-	Table* _table = NULL;
-
-	StaticTable() {
-	}
-	~StaticTable() {
-		if (_table) {
-			delete _table;
-		}
-	}
+	static_assert(N > 0 && N <= 16, "table bits out of range");
 
 public:
-	StaticTable(const StaticTable&) = delete;
-	void operator=(const StaticTable&) = delete;
+	StaticTable() = delete;
 
 	static const Table& table() {
-		static StaticTable<T, N> instance;
-		if (!instance._table) {
-			instance._table = new T(N);
-			instance._table->generate();
-		}
-		return *instance._table;
+		static constexpr Table instance(N, StaticTableData<T, N>::values.v, T::guardsBefore, T::guardsAfter);
+		return instance;
 	}
 };
 
-struct SineTable : Table {
-	SineTable(int n = 10) : Table(n) {}
-	void _generate() override;
+// First quarter of a sine cycle, unfolded by symmetry on lookup
+// Entry k is sin(pi/2 * k / length), for k = -1 to length + 2 (guard entries for the cubic lookup).
+struct QuarterSineTable {
+	static constexpr int guardsBefore = 1;
+	static constexpr int guardsAfter = 3;
+
+	static constexpr float quarter(int k, int bits) {
+		return k < 0 ? -quarter(-k, bits)
+			: k > (1 << bits) ? quarter(2 * (1 << bits) - k, bits)
+			: float(constexprSine(double((2.0f * float(M_PI)) * (k / (float)(1 << (bits + 2))))));
+	}
+	static constexpr float value(int i, int bits) {
+		return quarter(i - guardsBefore, bits);
+	}
+};
+// One table per lookup tier (see FMOpBank::InterpolationIds), with the lookup error relative to a full-scale sine:
+struct StaticQuarterSineTable : StaticTable<QuarterSineTable, 10> {
+	static constexpr int bits = 10;// nearest: -61 dB in 4 KB
+};
+struct StaticLinearSineTable : StaticTable<QuarterSineTable, 6> {
+	static constexpr int bits = 6;// linear: -85 dB in 272 bytes
+};
+struct StaticCubicSineTable : StaticTable<QuarterSineTable, 4> {
+	static constexpr int bits = 4;// cubic: -116 dB in 80 bytes
 };
-struct StaticSineTable : StaticTable<SineTable, 12> {};
 
 
 //-----------------------------------------------------------------------------
 // Decimator
 //-----------------------------------------------------------------------------
 
-struct Decimator {
-	Decimator() {}
-	virtual ~Decimator() {}
-
-	virtual void setParams(float sampleRate, int factor) = 0;
-	virtual float next(const float* buf) = 0;
+// Polyphase half-band decimator by 2, on four voices (one per float_4 lane); 4 * pairs - 1 taps, of which only the symmetric odd pairs and the center 0.5 are nonzero
+
+template<int MAXPAIRS>
+struct HalfBandStage4 {
+	simd::float_4 _odd[2 * MAXPAIRS];// branch with the coefficient pairs, circular
+	simd::float_4 _even[MAXPAIRS];// branch with the center tap, circular
+	int _pos = 0;
+	int _pairs = 1;
+	const float* _coefs = nullptr;
+	
+	void setCoefs(int pairs, const float* coefs) {
+		assert(pairs <= MAXPAIRS);
+		_pairs = pairs;
+		_coefs = coefs;
+		reset();
+	}
+	void reset() {
+		for (int i = 0; i < 2 * MAXPAIRS; i++) {
+			_odd[i] = 0.0f;
+		}
+		for (int i = 0; i < MAXPAIRS; i++) {
+			_even[i] = 0.0f;
+		}
+		_pos = 0;
+	}
+	inline simd::float_4 next(simd::float_4 x0, simd::float_4 x1) {
+		// x0 then x1 in time, returns one output sample
+		_pos = (_pos + 1) & (2 * MAXPAIRS - 1);
+		_odd[_pos] = x1;
+		_even[_pos & (MAXPAIRS - 1)] = x0;
+		simd::float_4 y = 0.5f * _even[(_pos - (_pairs - 1)) & (MAXPAIRS - 1)];
+		for (int k = 0; k < _pairs; k++) {
+			y += _coefs[k] * (_odd[(_pos - (_pairs - 1 - k)) & (2 * MAXPAIRS - 1)] + _odd[(_pos - (_pairs + k)) & (2 * MAXPAIRS - 1)]);
+		}
+		return y;
+	}
 };
 
-struct CICDecimator : Decimator {
-	typedef int64_t T;
-	static constexpr T scale = ((T)1) << 32;
-	int _stages;
-	T* _integrators = nullptr;
-	T* _combs = nullptr;
-	int _factor = 0;
-	float _gainCorrection;
-
-	CICDecimator(int stages = 4, int factor = 8);
-	virtual ~CICDecimator();
-	CICDecimator(const CICDecimator& srcc);
-	void copyFrom(const CICDecimator& srcc);
-	CICDecimator& operator=(const CICDecimator& srcc);
-	void setParams(float sampleRate, int factor) override final;
-	float next(const float* buf) override;
+// Cascade of up to four half-band stages, decimating by 2 to 16 (Kaiser windowed sinc, longest in the last stage)
+// More latency than the CIC, so FMOpBank takes its feedback and FM from the last sub-sample with these
+
+struct HalfBandDecimator4 {
+	enum ProfileIds {ECO_PROFILE, HQ_PROFILE};
+	static constexpr int maxFactor = 16;
+	HalfBandStage4<4> _stage16to8;
+	HalfBandStage4<4> _stage8to4;
+	HalfBandStage4<8> _stage4to2;
+	HalfBandStage4<16> _stage2to1;
+	
+	HalfBandDecimator4(int profile = ECO_PROFILE) {
+		setProfile(profile);
+	}
+	
+	void setProfile(int profile);
+	void reset() {
+		_stage16to8.reset();
+		_stage8to4.reset();
+		_stage4to2.reset();
+		_stage2to1.reset();
+	}
+	simd::float_4 next(const simd::float_4* buf, int factor);
 };
 
 
 //-----------------------------------------------------------------------------
-// SineTableOscillator
+// FMOpBank
 //-----------------------------------------------------------------------------
 
-struct Generator {
-	float _current = 0.0;
-
-	Generator() {}
-	virtual ~Generator() {}
-
-	float current() {
-		return _current;
+// All the FM operator voices of a module, as structure-of-arrays stepped four voices at a time (one per float_4 lane)
+
+struct FMOpBank {
+	static constexpr int numVoices = 16;
+	static constexpr int numGroups = numVoices / 4;
+	static constexpr float amplitude = 5.0f;
+	static constexpr int defaultOversample = 8;
+	static constexpr int maxOversample = HalfBandDecimator4::maxFactor;// 16x with a 4-stage CIC is 2^48 in the int64 registers
+	static constexpr float oversampleMixIncrement = 0.01f;
+	typedef int64_t cic_t;
+	static constexpr cic_t cicScale = ((cic_t)1) << 32;
+	static constexpr int cicStages = 4;
+	typedef uint32_t phase_t;
+	static constexpr phase_t maxPhase = UINT32_MAX;
+	static constexpr float turnsPerRadian = 1.0f / (2.0f * float(M_PI));
+	static constexpr float audibleBandwidth = 20000.0f;
+	static constexpr int adaptInterval = 16;
+	// a shift between two oversampled factors primes the second decimator, then crossfades into it (samples)
+	static constexpr int transitionPrimeSteps = 64;// the longest half-band cascade is 63 taps at 2x
+	static constexpr int transitionFadeSteps = 100;
+	static constexpr int adaaMaxOversample = 2;
+	static constexpr float adaaMinSpan = 0.01f;// radians, below which the second order ADAA falls back to the plain sine
+	// sine lookup: POLYNOMIAL_INTERPOLATION reads no table at all, the folded phase goes through polynomial()
+	enum InterpolationIds {NEAREST_INTERPOLATION, LINEAR_INTERPOLATION, CUBIC_INTERPOLATION, POLYNOMIAL_INTERPOLATION, NUM_INTERPOLATIONS};
+	enum DecimatorIds {CIC_DECIMATOR, HALFBAND_ECO_DECIMATOR, HALFBAND_HQ_DECIMATOR, NUM_DECIMATORS};
+	// anti-aliasing: oversampling alone, or antiderivative anti-aliasing (ADAA) of the sine, at up to adaaMaxOversample
+	enum EngineIds {OVERSAMPLING_ENGINE, ADAA1_ENGINE, ADAA2_ENGINE, NUM_ENGINES};
+	// step kernels, specialized at compile time: PLAIN is a bare sine (no modulation nor oversampling in any lane),
+	//   RAMP is unmodulated with the oversampling fading out, and the others add the feedback and/or FM offsets
+	enum KernelIds {PLAIN_KERNEL, RAMP_KERNEL, FEEDBACK_KERNEL, FM_KERNEL, FEEDBACK_FM_KERNEL};
+	
+	// voice state, per field
+	simd::int32_4 _phase[numGroups];// uint32 phases, in int32 lanes since the wrapping arithmetic is the same
+	simd::float_4 _feedbackDelayedSample[numGroups];// the last output as the feedback and FM see it (see HalfBandDecimator4)
+	simd::float_4 _feedbackSlewed[numGroups];
+	simd::float_4 _oversampleMix[numGroups];
+	simd::float_4 _feedbackLoop[numGroups];// smoothed sub-samples, for the in-loop feedback
+	// ADAA history: the previous sine argument, and for the second order the previous divided difference
+	//   of the second antiderivative (-sin) with the span it was taken over (radians)
+	struct AdaaState {
+		simd::int32_4 x;
+		simd::float_4 slope;
+		simd::float_4 span;
+	};
+	AdaaState _adaaBase[numGroups];// sine at the sample rate
+	AdaaState _adaaLoop[numGroups];// sine in the oversampled loop
+	bool _adaaLoopPrimed[numGroups];// whether _adaaLoop follows on from the previous sub-sample
+	// decimator state, per group: the CIC registers of its four voices, and the half-band cascade
+	struct GroupDecimator {
+		alignas(16) cic_t cicIntegrators[cicStages + 1][4];
+		alignas(16) cic_t cicCombs[cicStages][4];
+		HalfBandDecimator4 halfBand;
+		int type = CIC_DECIMATOR;// see DecimatorIds
+		
+		void reset(int decimator);
+	};
+	GroupDecimator _decimators[numGroups][2];// the current one, and the next one during a transition
+	int _currentDecimator[numGroups];
+	int _groupOversample[numGroups];// factor the group runs at, adapted to its voices
+	int _nextOversample[numGroups];// factor being crossfaded into, 0 = none
+	int _transitionSteps[numGroups];
+	bool _groupOversampling[numGroups];// whether the modulated voices of the group may oversample
+	int _adaptCountdown[numGroups];
+	int _downshiftHold[numGroups];
+	
+	// shared
+	float _sampleRate = 1000.0f;
+	float _maxFrequency = 0.0f;
+	float _deltaPerHz = 0.0f;// phase increment per sample, for 1 Hz
+	float _feedbackSlewDelta = 0.0f;
+	int _downshiftHoldSteps = 0;
+	int _decimator = CIC_DECIMATOR;
+	int _oversample = defaultOversample;// maximum factor: 1, 2, 4, 8 or 16
+	int _oversampleLimit = maxOversample;// further cap, see OversampleGovernor
+	int _interpolation = NEAREST_INTERPOLATION;
+	int _engine = OVERSAMPLING_ENGINE;
+	bool _adaptive = false;
+	bool _inLoopFeedback = false;
+	float _feedbackLoopCoefficients[maxOversample + 1];// by factor, see feedbackLoopCoefficient()
+
+	FMOpBank(float sampleRate = 1000.0f) {
+		for (int f = 1; f <= maxOversample; f++) {
+			_feedbackLoopCoefficients[f] = feedbackLoopCoefficient(f);
+		}
+		_feedbackLoopCoefficients[0] = 0.0f;
+		for (int g = 0; g < numGroups; g++) {
+			_feedbackDelayedSample[g] = 0.0f;
+			_feedbackSlewed[g] = 0.0f;
+			_oversampleMix[g] = 0.0f;
+			_feedbackLoop[g] = 0.0f;
+			_currentDecimator[g] = 0;
+			_groupOversample[g] = 1;
+			_nextOversample[g] = 0;
+			_transitionSteps[g] = 0;
+			_groupOversampling[g] = false;
+			_adaptCountdown[g] = 0;
+			_downshiftHold[g] = 0;
+			_decimators[g][0].reset(_decimator);
+		}
+		onSampleRateChange(sampleRate);
+		onReset();
 	}
 
-	float next() {
-		return _current = _next();
+	void onReset();
+	// phases of group g back to 0, sinceReset samples before the next step() at pitch voct (1 is as onReset())
+	void resetPhase(int g, simd::float_4 voct, float sinceReset);
+	void dataToJson(json_t *rootJ, std::string id, int voice);
+	void dataFromJson(json_t *rootJ, std::string id, int voice);
+	void onSampleRateChange(float newSampleRate);
+	void setDecimator(int decimator);
+	void setOversample(int oversample);
+	void setEngine(int engine);
+	inline void setInterpolation(int interpolation) {
+		_interpolation = interpolation;
 	}
-
-	virtual float _next() = 0;
-};
-
-struct Oscillator {
-	float _sampleRate;
-	float _frequency;
-
-	Oscillator(
-		float sampleRate = 1000.0f,
-		float frequency = 100.0f
-	)
-	: _sampleRate(sampleRate > 1.0 ? sampleRate : 1.0)
-	, _frequency(frequency)
-	{
+	// caps the adapted factor below setOversample()'s; groups above it drop to it as when adapting down, without the hold
+	inline void setOversampleLimit(int limit) {
+		_oversampleLimit = limit;
 	}
-	virtual ~Oscillator() {}
-
-	void setSampleRate(float sampleRate) {
-		if (_sampleRate != sampleRate && sampleRate >= 1.0) {
-			_sampleRate = sampleRate;
-			_sampleRateChanged();
+	// factor per group from its voices' bandwidth, rather than always the maximum (as in patches saved before it)
+	inline void setAdaptive(bool adaptive) {
+		_adaptive = adaptive;
+	}
+	// self-feedback (momentum) computed per oversampled sub-sample, rather than from the previous sample
+	inline void setInLoopFeedback(bool inLoopFeedback) {
+		_inLoopFeedback = inLoopFeedback;
+	}
+	// The in-loop feedback goes through a one-pole lowpass at a quarter of the base sample rate, whatever
+	//   the factor: above unity feedback index, the raw (or two-sample averaged) sub-samples make the loop
+	//   hunt, and the noise grows with the factor.
+	inline static float feedbackLoopCoefficient(int factor) {
+		return 1.0f - std::exp(-0.5f * float(M_PI) / (float)factor);
+	}
+	simd::float_4 step(int g, simd::float_4 voct, simd::float_4 momentum, simd::float_4 fmDepth = 0.0f, simd::float_4 fmInput = 0.0f);
+	// Cross-modulated pair, as m.step() with c's previous _feedbackDelayedSample as FM input, then c.step() with m's new one,
+	//   fused into one kernel dispatch when both pick the same kernel: both steps are then inlined into the same 
+	//   function, so c's pitch, slew and adaptation work can overlap m's oversampled loop (c's loop needs m's output)
+	static void stepPair(FMOpBank& m, FMOpBank& c, int g, 
+		simd::float_4 voctM, simd::float_4 momentumM, simd::float_4 fmDepthM, 
+		simd::float_4 voctC, simd::float_4 momentumC, simd::float_4 fmDepthC, 
+		simd::float_4& outM, simd::float_4& outC);
+	// n samples of step() for group g, from per-sample inputs; fmDepth and fmInput can be nullptr
+	void processBlock(int g, int n, const simd::float_4* voct, const simd::float_4* momentum, const simd::float_4* fmDepth, const simd::float_4* fmInput, simd::float_4* out);
+	// instead of step() for a group whose output is unused: the phases advance by one sample and nothing else runs,
+	//   with the oversampling and ADAA restarted from the current phase, so that the next step() starts cleanly
+	void sleep(int g, simd::float_4 voct);
+	
+	// The sine lookup and the anti-aliasing engine are template parameters of the step kernels (see the dispatch in EnergyOsc.cpp), 
+	//   so that the oversampled loop has no setting to test
+	template<int INTERPOLATION>
+	inline static simd::float_4 _sineForPhase(simd::int32_4 phase) {
+		if (INTERPOLATION == LINEAR_INTERPOLATION) {
+			return _sineInterpolated<StaticLinearSineTable, false>(phase);
+		}
+		if (INTERPOLATION == CUBIC_INTERPOLATION) {
+			return _sineInterpolated<StaticCubicSineTable, true>(phase);
 		}
+		if (INTERPOLATION == POLYNOMIAL_INTERPOLATION) {
+			return _sinePolynomial(phase);
+		}
+		return _sineNearest(phase);
 	}
-
-	virtual void _sampleRateChanged() {}
-
-	void setFrequency(float frequency) {
-		if (_frequency != frequency) {
-			_frequency = frequency;
-			_frequencyChanged();
+	inline static simd::float_4 _sineNearest(simd::int32_4 phase) {
+		// quarter-wave lookup: phase bit 30 mirrors the index within the quarter, bit 31 is the sign
+		const int bits = StaticQuarterSineTable::bits;
+		const float* table = StaticQuarterSineTable::table().data();
+		__m128i i = _mm_and_si128(_mm_srli_epi32(phase.v, 30 - bits), _mm_set1_epi32((1 << bits) - 1));
+		__m128i mirror = _mm_srai_epi32(_mm_slli_epi32(phase.v, 1), 31);
+		i = _mm_add_epi32(_mm_sub_epi32(_mm_xor_si128(i, mirror), mirror), _mm_and_si128(mirror, _mm_set1_epi32(1 << bits)));// length - i when mirrored
+		simd::int32_4 j = i;
+		simd::float_4 v = simd::float_4(table[j[0]], table[j[1]], table[j[2]], table[j[3]]);
+		return _mm_xor_ps(v.v, _mm_castsi128_ps(_mm_and_si128(phase.v, _mm_set1_epi32(0x80000000))));
+	}
+	inline static __m128i _foldQuarter(simd::int32_4 phase) {
+		// phase within the first quarter, 0 to 2^30, mirrored when bit 30 is set
+		__m128i p = _mm_and_si128(phase.v, _mm_set1_epi32(0x3FFFFFFF));
+		__m128i mirror = _mm_srai_epi32(_mm_slli_epi32(phase.v, 1), 31);
+		return _mm_add_epi32(_mm_sub_epi32(_mm_xor_si128(p, mirror), mirror), _mm_and_si128(mirror, _mm_set1_epi32(0x40000000)));// 2^30 - p when mirrored
+	}
+	inline static simd::float_4 _sinePolynomial(simd::int32_4 phase) {
+		// no gather: four lanes of arithmetic only
+		simd::float_4 x = simd::float_4(_mm_cvtepi32_ps(_foldQuarter(phase))) * (1.0f / (float)(1u << 30));
+		simd::float_4 v = polynomial(x);
+		return _mm_xor_ps(v.v, _mm_castsi128_ps(_mm_and_si128(phase.v, _mm_set1_epi32(0x80000000))));
+	}
+	template<class TABLE, bool CUBIC>
+	inline static simd::float_4 _sineInterpolated(simd::int32_4 phase) {
+		// the phase is folded onto the first quarter (so that the fraction is mirrored along with the index), 
+		//   then split into a table index (top bits) and an interpolation fraction (the rest)
+		const int shift = 30 - TABLE::bits;
+		const float* table = TABLE::table().data();
+		__m128i p = _foldQuarter(phase);
+		simd::int32_4 i = _mm_srli_epi32(p, shift);
+		simd::float_4 f = simd::float_4(_mm_cvtepi32_ps(_mm_and_si128(p, _mm_set1_epi32((1 << shift) - 1)))) * (1.0f / (float)(1 << shift));
+		simd::float_4 y0 = simd::float_4(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+		simd::float_4 y1 = simd::float_4(table[i[0] + 1], table[i[1] + 1], table[i[2] + 1], table[i[3] + 1]);
+		simd::float_4 v;
+		if (CUBIC) {
+			simd::float_4 ym1 = simd::float_4(table[i[0] - 1], table[i[1] - 1], table[i[2] - 1], table[i[3] - 1]);
+			simd::float_4 y2 = simd::float_4(table[i[0] + 2], table[i[1] + 2], table[i[2] + 2], table[i[3] + 2]);
+			v = cubic(ym1, y0, y1, y2, f);
 		}
+		else {
+			v = y0 + f * (y1 - y0);
+		}
+		return _mm_xor_ps(v.v, _mm_castsi128_ps(_mm_and_si128(phase.v, _mm_set1_epi32(0x80000000))));
 	}
-
-	virtual void _frequencyChanged() {}
-};
-
-struct OscillatorGenerator : Oscillator, Generator {
-	OscillatorGenerator(
-		float sampleRate = 1000.0f,
-		float frequency = 100.0f
-	)
-	: Oscillator(sampleRate, frequency)
-	{
+	template<int ENGINE, int INTERPOLATION>
+	inline static simd::float_4 _sine(simd::int32_4 x, AdaaState& state) {
+		if (ENGINE == ADAA1_ENGINE) {
+			return _sineAdaa1<INTERPOLATION>(x, state);
+		}
+		if (ENGINE == ADAA2_ENGINE) {
+			return _sineAdaa2(x, state);
+		}
+		return _sineForPhase<INTERPOLATION>(x);
 	}
-};
-
-struct Phasor : OscillatorGenerator {
-	typedef uint32_t phase_t;
-	typedef int64_t phase_delta_t;
-	static constexpr phase_t maxPhase = UINT32_MAX;
-	static constexpr float twoPI = 2.0f * float(M_PI);
-	static constexpr float maxSampleWidth = 0.25f;
-
-	phase_delta_t _delta;
-	phase_t _phase = 0;
-	float _sampleWidth = 0.0f;
-	phase_t _samplePhase = 0;
-
-	Phasor(
-		float sampleRate = 1000.0f,
-		float frequency = 100.0f,
-		float initialPhase = 0.0f
-	)
-	: OscillatorGenerator(sampleRate, frequency)
-	{
-		setPhase(initialPhase);
-		_update();
+	inline static simd::float_4 _phaseToRadians(simd::int32_4 phase) {
+		return simd::float_4(_mm_cvtepi32_ps(phase.v)) * (float(M_PI) / 2147483648.0f);// signed, -pi to pi
 	}
-
-	void _sampleRateChanged() override {
-		_update();
+	inline static simd::float_4 _sinc(simd::float_4 u) {
+		// sin(u) / u for |u| <= pi/2, to u^8 (error below 3e-6)
+		simd::float_4 u2 = u * u;
+		return 1.0f + u2 * (-1.0f / 6.0f + u2 * (1.0f / 120.0f + u2 * (-1.0f / 5040.0f + u2 * (1.0f / 362880.0f))));
 	}
-
-	void _frequencyChanged() override {
-		_update();
+	template<int INTERPOLATION>
+	inline static simd::float_4 _sineAdaa1(simd::int32_4 x, AdaaState& state) {
+		// (F1(x) - F1(x1)) / (x - x1) with F1 = -cos, which is sin(midpoint) * sinc(half span): no division, 
+		//   so no ill-conditioned case; the span wraps with the phase, as long as it stays under half a turn
+		simd::int32_4 d = x - state.x;
+		simd::int32_4 midpoint = state.x + simd::int32_4(_mm_srai_epi32(d.v, 1));
+		state.x = x;
+		return _sineForPhase<INTERPOLATION>(midpoint) * _sinc(_phaseToRadians(d) * 0.5f);
+	}
+	inline static simd::float_4 _sineAdaa2(simd::int32_4 x, AdaaState& state) {
+		// 2 / (x - x2) * (D(x, x1) - D(x1, x2)), where D(a, b) = (F2(a) - F2(b)) / (a - b) with F2 = -sin is
+		//   -cos(midpoint) * sinc(half span); D(x1, x2) is kept from the previous call.
+		// The division amplifies lookup errors (by 2 / span), so this always uses the polynomial sine, whatever the INTERPOLATION.
+		simd::int32_4 d = x - state.x;
+		simd::float_4 span = _phaseToRadians(d);
+		simd::int32_4 midpoint = state.x + simd::int32_4(_mm_srai_epi32(d.v, 1));
+		simd::float_4 slope = -_sinePolynomial(midpoint + simd::int32_4(0x40000000)) * _sinc(span * 0.5f);
+		simd::float_4 total = span + state.span;
+		simd::float_4 ill = simd::abs(total) < adaaMinSpan;
+		simd::float_4 y = 2.0f * (slope - state.slope) / simd::ifelse(ill, simd::float_4(1.0f), total);
+		if (simd::movemask(ill) != 0) {
+			y = simd::ifelse(ill, _sinePolynomial(state.x), y);
+		}
+		state.x = x;
+		state.slope = slope;
+		state.span = span;
+		return y;
+	}
+	inline static void _resetAdaa(AdaaState& state, simd::int32_4 x) {
+		// as if the sine had stood still at x: the divided difference over an empty span is F2' = -cos
+		state.x = x;
+		state.slope = -_sinePolynomial(x + simd::int32_4(0x40000000));
+		state.span = 0.0f;
+	}
+	// one output sample of d at factor, from every stride-th sub-sample of buf; feedback is what the feedback loops take from it
+	static simd::float_4 _decimate(GroupDecimator& d, int factor, int stride, const simd::float_4* buf, simd::float_4 active, simd::float_4& feedback);
+	// as _decimate() with the group's decimators, crossfading between them during a transition
+	simd::float_4 _decimateGroup(int g, int loopFactor, const simd::float_4* buf, simd::float_4 active, simd::float_4& feedback);
+	void _beginTransition(int g, int factor);
+	void _endTransition(int g);
+	void _restartOversampling(int g);
+	static simd::float_4 _feedbackHarmonics(simd::float_4 feedbackIndex);
+	simd::float_4 _bandwidth(int g, simd::float_4 voct) const;
+	static float _highestPartial(simd::float_4 frequency, simd::float_4 feedbackIndex, simd::float_4 fmIndex, simd::float_4 fmBandwidth, simd::float_4 modulating);
+	bool _adaptOversample(int g, float highestPartial, simd::float_4 oversampleMix);
+	int _selectKernel(int g, simd::float_4 maxMomentum, bool fm);
+	template<int KERNEL, int ENGINE, int INTERPOLATION>
+	static void _stepPair(FMOpBank& m, FMOpBank& c, int g, 
+		simd::float_4 voctM, simd::float_4 momentumM, simd::float_4 fmDepthM, 
+		simd::float_4 voctC, simd::float_4 momentumC, simd::float_4 fmDepthC, 
+		simd::float_4& outM, simd::float_4& outC);
+	// modulator is the bank whose output is fmInput, at modulatorVoct, or nullptr when unknown
+	template<int KERNEL, int ENGINE, int INTERPOLATION>
+	simd::float_4 _step(int g, simd::int32_4& phase, simd::float_4& feedbackSlewed, simd::float_4& feedbackDelayedSample, simd::float_4& oversampleMix, 
+		simd::float_4 voct, simd::float_4 momentum, simd::float_4 fmDepth, simd::float_4 fmInput, const FMOpBank* modulator, simd::float_4 modulatorVoct);
+	simd::float_4 _stepKernel(int kernel, int g, simd::float_4 voct, simd::float_4 momentum, simd::float_4 fmDepth, simd::float_4 fmInput, 
+		const FMOpBank* modulator, simd::float_4 modulatorVoct);
+	template<int KERNEL, int ENGINE, int INTERPOLATION>
+	void _processBlock(int g, int n, const simd::float_4* voct, const simd::float_4* momentum, const simd::float_4* fmDepth, const simd::float_4* fmInput, simd::float_4* out);
+	// Phase offsets are computed in turns (gains pre-scaled by turnsPerRadian), then converted by adding 1.5 * 2^20:
+	//   the sum's last mantissa bit (in double) is then 2^-32 turn, so its low 32 bits are the wrapped phase 
+	//   (for |turns| < 2^19), with no float to int conversion and no modulo.
+	static simd::int32_4 turnsToPhase(simd::float_4 turns);
+	template<typename T>
+	inline static T cubic(T ym1, T y0, T y1, T y2, T f) {
+		// 4-point Lagrange
+		T c1 = y1 - ym1 * (1.0f / 3.0f) - y0 * 0.5f - y2 * (1.0f / 6.0f);
+		T c2 = (ym1 + y1) * 0.5f - y0;
+		T c3 = (y2 - ym1) * (1.0f / 6.0f) + (y0 - y1) * 0.5f;
+		return ((c3 * f + c2) * f + c1) * f + y0;
+	}
+	template<typename T>
+	inline static T polynomial(T x) {
+		// odd minimax fit of sin(pi/2 * x) for x in [0, 1]: -124 dB, better than the cubic table
+		T x2 = x * x;
+		return x * (1.570791011f + x2 * (-0.6458928495f + x2 * (0.07943434462f + x2 * -0.004333095292f)));
 	}
-
-	phase_t getPhase() {return _phase;}
-	void setSampleWidth(float sw);
-	void resetPhase();
-	void setPhase(float radians);
-	void setPhase(phase_t givenPhase) {_phase = givenPhase;}
-	float nextFromPhasor(const Phasor& phasor, phase_delta_t offset = 0);
-	inline float nextForPhase(phase_t phase) { return _nextForPhase(phase); }
-	void _update();
-	inline void advancePhase() { _phase += _delta; }
-	inline void advancePhase(int n) { assert(n > 0); _phase += n * _delta; }
-	float _next() override final;
-	virtual float _nextForPhase(phase_t phase);
-
-	inline static phase_delta_t radiansToPhase(float radians) { return (radians / twoPI) * (float)maxPhase; }
-	inline static float phaseToRadians(phase_t phase) { return (phase / (float)maxPhase) * twoPI; }
 };
+static_assert(std::is_trivially_copyable<FMOpBank>::value, "FMOpBank holds all its state inline");
 
-struct TablePhasor : Phasor {
-	const Table& _table;
-	int _tableLength;
-
-	TablePhasor(
-		const Table& table,
-		double sampleRate = 1000.0f,
-		double frequency = 100.0f
-	)
-	: Phasor(sampleRate, frequency)
-	, _table(table)
-	, _tableLength(table.length())
-	{
-	}
 
-	float _nextForPhase(phase_t phase) override;
-};
+//-----------------------------------------------------------------------------
+// OversampleGovernor
+//-----------------------------------------------------------------------------
 
-struct SineTableOscillator : TablePhasor {
-	SineTableOscillator(
-		float sampleRate = 1000.0f,
-		float frequency = 100.0f
-	)
-	: TablePhasor(StaticSineTable::table(), sampleRate, frequency)
-	{
+// Auto quality: lowers the oversampling limit of a module's FMOpBanks while its process() exceeds a CPU budget
+
+struct OversampleGovernor {
+	static constexpr int measureInterval = 17;// prime, so that the timed calls walk through the modules' periodic work
+	static constexpr float averageTime = 0.05f;// seconds
+	static constexpr float holdTime = 0.25f;// seconds
+	static constexpr float upshiftHeadroom = 0.4f;
+	
+	int _limit = FMOpBank::maxOversample;
+	float _load = 0.0f;
+	float _loadCoefficient = 0.0f;
+	float _nanosecondsToLoad = 0.0f;
+	int _holdMeasures = 0;
+	int _hold = 0;
+	int _countdown = measureInterval;
+	bool _measuring = false;
+	std::chrono::steady_clock::time_point _start;
+	
+	OversampleGovernor(float sampleRate = 1000.0f) {
+		onSampleRateChange(sampleRate);
+	}
+	
+	// from the module's onReset()
+	void reset() {
+		_limit = FMOpBank::maxOversample;
+		_load = 0.0f;
+		_hold = 0;
 	}
+	void onSampleRateChange(float sampleRate);
+	// times one process() call in measureInterval, none when off (budget in percent of the sample period, 0 = off)
+	inline void begin(int budget) {
+		if (budget <= 0) {
+			_limit = FMOpBank::maxOversample;
+			_hold = 0;
+			return;
+		}
+		if (--_countdown <= 0) {
+			_countdown = measureInterval;
+			_measuring = true;
+			_start = std::chrono::steady_clock::now();
+		}
+	}
+	inline void end(int budget, int oversample) {
+		if (_measuring) {
+			_measuring = false;
+			_update(std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - _start).count(), budget, oversample);
+		}
+	}
+	inline int limit() {
+		return _limit;
+	}
+	
+	void _update(float nanoseconds, int budget, int oversample);
 };
 
 
-
 //-----------------------------------------------------------------------------
-// FMOp
+// FMOpSettings
 //-----------------------------------------------------------------------------
 
-struct FMOp {
-	const float amplitude = 5.0f;
-	const int modulationSteps = 100;
-	static constexpr int oversample = 8;
-	const float oversampleMixIncrement = 0.01f;
-	int _steps = 0;
-	float _feedbackDelayedSample = 0.0f;
-	float _maxFrequency = 0.0f;
-	float _buffer[oversample] = {};
-	float _oversampleMix = 0.0f;
-	Phasor _phasor;
-	SineTableOscillator _sineTable;
-	CICDecimator _decimator;
-	SlewLimiter _feedbackSL;
-
-	FMOp(float _sampleRate) {
-		onSampleRateChange(_sampleRate);
+// The context menu settings of the modules built on FMOpBank, saved with the module and reset by onReset()
+
+struct FMOpSettings {
+	int decimator;// see FMOpBank::DecimatorIds
+	int interpolation;// sine lookup, see FMOpBank::InterpolationIds
+	int oversample;// maximum factor, 1, 2, 4, 8 or 16
+	int engine;// anti-aliasing, see FMOpBank::EngineIds
+	int adaptive;// 0 = always the maximum factor when modulating, 1 = the factor each voice's bandwidth needs
+	int inLoopFeedback;// 0 = momentum from the previous sample, 1 = per oversampled sub-sample
+	int cpuBudget;// auto quality: percent of the sample period before the oversampling is lowered, 0 = off
+	int controlRate;// Hz at which the modulation is computed, then ramped to; 0 = audio rate
+	
+	FMOpSettings() {
 		onReset();
 	}
-
+	
 	void onReset();
-	void dataToJson(json_t *rootJ, std::string id);
-	void dataFromJson(json_t *rootJ, std::string id);
-	void onSampleRateChange(float newSampleRate);
-	float step(float voct, float momentum, float fmDepth = 0.0f, float fmInput = 0.0f);
+	void dataToJson(json_t *rootJ);
+	// values out of range (from a hand edited or newer patch) are brought back to the nearest valid one
+	void dataFromJson(json_t *rootJ);
+	// all but the oversampling limit, which comes from the module's OversampleGovernor
+	void apply(FMOpBank& bank);
+	// samples between modulation updates
+	inline int controlInterval(float sampleRate) {
+		return controlRate == 0 ? 1 : std::max(1, (int)std::round(sampleRate / (float)controlRate));
+	}
 };
+
+// the settings part of a module's context menu, as createPanelThemeMenu()
+void createFMOpSettingsMenu(ui::Menu* menu, FMOpSettings* settings);
+
@@ -293,6 +293,112 @@ struct RefreshCounter {
 };
 
 
+// Change detection for values derived from knobs and CVs: every sample, the values they depend on are added 
+//   in the same order, and changed() tells whether any differs from the previous sample (or reset() was called)
+template<int N>
+struct ChangeDetector {
+	float last[N] = {};
+	int index = 0;
+	bool dirty = true;
+	
+	void reset() {
+		dirty = true;
+	}
+	
+	void add(float value) {
+		assert(index < N);
+		if (last[index] != value) {
+			last[index] = value;
+			dirty = true;
+		}
+		index++;
+	}
+	
+	bool changed() {
+		assert(index == N);// as many values added as the detector holds
+		bool ret = dirty;
+		dirty = false;
+		index = 0;
+		return ret;
+	}
+};
+
+// voltage a channel reads from a CV input (the input's last channel when it has fewer), 0 when unconnected
+inline float getCv(Input& input, int chan) {
+	if (!input.isConnected()) {
+		return 0.0f;
+	}
+	return input.getVoltage(std::min(input.getChannels() - 1, chan));
+}
+
+// Modulation computed every interval samples (from the module's control rate) and ramped to in between, 
+//   for N per channel arrays of the module, set in values[]: at each update the module recomputes the 
+//   channels whose inputs changed between begin() and end(), and calls clear() for the others
+template<int N>
+struct ControlRamp {
+	static constexpr int numChannels = 16;
+	float* values[N];
+	float steps[N][numChannels];// per sample
+	float lasts[N];
+	int interval;
+	int countdown;
+	int ramp;// samples left to ramp
+	bool ramping;
+	
+	void reset() {
+		for (int c = 0; c < numChannels; c++) {
+			clear(c);
+		}
+		interval = 1;
+		countdown = 0;
+		ramp = 0;
+	}
+	// every sample, true when an update is due, otherwise the first numChan channels take a step of their ramp
+	bool tick(int numChan) {
+		if (--countdown <= 0) {
+			countdown = interval;
+			ramping = false;
+			return true;
+		}
+		if (ramp > 0) {
+			ramp--;
+			for (int i = 0; i < N; i++) {
+				for (int c = 0; c < numChan; c++) {
+					values[i][c] += steps[i][c];
+				}
+			}
+		}
+		return false;
+	}
+	void begin(int chan) {
+		for (int i = 0; i < N; i++) {
+			lasts[i] = values[i][chan];
+		}
+	}
+	void end(int chan) {
+		if (interval > 1) {
+			for (int i = 0; i < N; i++) {
+				steps[i][chan] = (values[i][chan] - lasts[i]) / (float)interval;
+				values[i][chan] = lasts[i] + steps[i][chan];
+			}
+		}
+		ramping = true;
+	}
+	void clear(int chan) {
+		for (int i = 0; i < N; i++) {
+			steps[i][chan] = 0.0f;
+		}
+	}
+	// after the update of the first numChan channels
+	void update(int numChan) {
+		for (int c = numChan; c < numChannels; c++) {
+			clear(c);// in case the channel count grows during the ramp
+		}
+		ramp = ramping ? interval - 1 : 0;
+	}
+};
+
+
 struct Trigger {
 	bool state = true;
 